@@ -0,0 +1,519 @@
+
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include "simple_svg_1.0.0.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <random>
+
+using namespace svg;
+
+// Benchmarks for the Simple SVG library.  Results are written as JSON to
+//  stdout, or to the file given with --output.  All input data comes from
+//  a fixed seed, so runs are comparable.
+//
+//  Usage: simple_svg_bench [--max-elements N] [--output FILE]
+
+// Heap accounting for the peak memory figures.  Every allocation carries
+//  its size in a header so that deallocation can be counted too.
+namespace
+{
+    std::atomic<long long> heap_current(0);
+    std::atomic<long long> heap_peak(0);
+
+    union AllocationHeader
+    {
+        std::size_t size;
+        std::max_align_t alignment;
+    };
+
+    void resetPeak()
+    {
+        heap_peak = heap_current.load();
+    }
+}
+
+void * operator new(std::size_t size)
+{
+    AllocationHeader * header =
+        static_cast<AllocationHeader *>(std::malloc(sizeof(AllocationHeader) + size));
+    if (!header)
+        throw std::bad_alloc();
+    header->size = size;
+
+    long long current = heap_current += static_cast<long long>(size);
+    long long peak = heap_peak.load();
+    while (current > peak && !heap_peak.compare_exchange_weak(peak, current)) { }
+    return header + 1;
+}
+
+void operator delete(void * pointer) noexcept
+{
+    if (!pointer)
+        return;
+    AllocationHeader * header = static_cast<AllocationHeader *>(pointer) - 1;
+    heap_current -= static_cast<long long>(header->size);
+    std::free(header);
+}
+
+void operator delete(void * pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double secondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    class Report
+    {
+    public:
+        Report() : first(true) { json = "{\n  \"benchmarks\": [\n"; }
+
+        // Records one result.  bytes and peak_heap are left out when negative.
+        void add(std::string const & name, std::string const & kind, long long iterations,
+            double seconds, long long bytes = -1, long long peak_heap = -1)
+        {
+            char line[512];
+            std::snprintf(line, sizeof(line),
+                "%s    {\"name\": \"%s\", \"kind\": \"%s\", \"iterations\": %lld, "
+                "\"seconds\": %.6f, \"ns_per_op\": %.2f",
+                first ? "" : ",\n", name.c_str(), kind.c_str(), iterations, seconds,
+                seconds * 1e9 / (iterations ? iterations : 1));
+            json += line;
+            if (bytes >= 0) {
+                std::snprintf(line, sizeof(line), ", \"bytes\": %lld, \"mb_per_s\": %.2f",
+                    bytes, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+                json += line;
+            }
+            if (peak_heap >= 0) {
+                std::snprintf(line, sizeof(line), ", \"peak_heap_bytes\": %lld", peak_heap);
+                json += line;
+            }
+            json += "}";
+            first = false;
+            std::fprintf(stderr, "%-40s %12.2f ns/op\n", name.c_str(),
+                seconds * 1e9 / (iterations ? iterations : 1));
+        }
+        std::string finish()
+        {
+            return json + "\n  ]\n}\n";
+        }
+    private:
+        bool first;
+        std::string json;
+    };
+
+    std::vector<Point> randomWalk(std::size_t count, std::mt19937 & random)
+    {
+        std::normal_distribution<double> step(0, 1);
+        std::vector<Point> points;
+        points.reserve(count);
+        double y = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            y += step(random);
+            points.push_back(Point(i * 0.01, y));
+        }
+        return points;
+    }
+
+    // Runs body repeatedly for at least min_seconds and returns the
+    //  iteration count and elapsed time.
+    template <typename Body>
+    void measure(Report & report, std::string const & name, Body body, double min_seconds = 0.2)
+    {
+        long long iterations = 0;
+        long long batch = 1;
+        Clock::time_point start = Clock::now();
+        double elapsed = 0;
+        while (elapsed < min_seconds) {
+            for (long long i = 0; i < batch; ++i)
+                body();
+            iterations += batch;
+            batch *= 2;
+            elapsed = secondsSince(start);
+        }
+        report.add(name, "micro", iterations, elapsed);
+    }
+
+    template <typename T>
+    void measureShape(Report & report, std::string const & name, T const & shape,
+        Layout const & layout)
+    {
+        std::size_t sink = 0;
+        measure(report, name + "/toString", [&]() {
+            sink += shape.toString(layout).size();
+        });
+        std::string buffer;
+        measure(report, name + "/serialize", [&]() {
+            buffer.clear();
+            shape.serialize(buffer, layout);
+            sink += buffer.size();
+        });
+        if (sink == 0)
+            std::fprintf(stderr, "unexpected empty output\n");
+    }
+
+    void microBenchmarks(Report & report)
+    {
+        std::mt19937 random(42);
+        Layout layout(Dimensions(1000, 1000));
+
+        measureShape(report, "circle", Circle(Point(12.5, 40.25), 3, Color::Red,
+            Stroke(1, Color::Black)), layout);
+        measureShape(report, "rect", Rectangle(Point(12.5, 40.25), 30, 20, Color::Blue), layout);
+        measureShape(report, "line", Line(Point(1, 2), Point(300.5, 400.25),
+            Stroke(2, Color::Green)), layout);
+        measureShape(report, "text", Text(Point(5, 77), "Simple SVG", Color::Silver,
+            Font(10, "Verdana")), layout);
+        measureShape(report, "polyline100", Polyline(randomWalk(100, random), Fill(),
+            Stroke(1, Color::Blue)), layout);
+
+        Path path(Stroke(1, Color::Black));
+        std::vector<Point> walk = randomWalk(100, random);
+        for (std::size_t i = 0; i < walk.size(); ++i)
+            path << walk[i];
+        measureShape(report, "path100", path, layout);
+
+        std::size_t sink = 0;
+        double value = 123.456789;
+        measure(report, "attribute/template", [&]() {
+            sink += attribute("cx", 12).size();
+        });
+        measure(report, "attribute/double", [&]() {
+            sink += attribute("cx", value).size();
+        });
+        std::string buffer;
+        NumberFormat formats[] = { NumberFormat(), NumberFormat::shortest(), NumberFormat::fixed(2) };
+        char const * format_names[] = { "default", "shortest", "fixed2" };
+        for (int i = 0; i < 3; ++i) {
+            measure(report, std::string("appendAttribute/") + format_names[i], [&]() {
+                buffer.clear();
+                appendAttribute(buffer, "cx", value, formats[i]);
+                sink += buffer.size();
+            });
+        }
+        std::string const labels[] = { "Throughput per region, last 24 hours (p99)",
+            "Latency < 10 ms & errors < 0.1% for \"eu-west\" nodes" };
+        char const * label_names[] = { "clean", "special" };
+        for (int i = 0; i < 2; ++i) {
+            measure(report, std::string("escape/") + label_names[i], [&]() {
+                buffer.clear();
+                appendEscaped(buffer, labels[i].data(), labels[i].size(), true);
+                sink += buffer.size();
+            });
+        }
+        if (sink == 0)
+            std::fprintf(stderr, "unexpected empty output\n");
+    }
+
+    void lineChartBenchmarks(Report & report, std::size_t max_points)
+    {
+        std::mt19937 random(7);
+        for (std::size_t points = 1000; points <= max_points && points <= 1000000; points *= 10) {
+            LineChart chart(5.0);
+            chart << Polyline(randomWalk(points, random), Fill(), Stroke(.5, Color::Blue));
+
+            std::string buffer;
+            long long baseline = heap_current;
+            resetPeak();
+            Clock::time_point start = Clock::now();
+            chart.serialize(buffer, Layout(Dimensions(1000, 500)));
+            double seconds = secondsSince(start);
+            report.add("linechart/" + std::to_string(points), "macro", 1, seconds,
+                static_cast<long long>(buffer.size()), heap_peak - baseline);
+        }
+    }
+
+    // Pushes samples into a rolling chart and renders its window now and
+    //  then, as a live view would.
+    void rollingChartBenchmarks(Report & report, std::size_t max_points)
+    {
+        std::size_t const window = 3600;
+        RollingLineChart chart(window);
+        std::size_t series = chart.addSeries(Stroke(.5, Color::Blue));
+        std::size_t const samples = max_points < 1000000 ? max_points : 1000000;
+        std::string buffer;
+        Layout layout(Dimensions(1000, 500));
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < samples; ++i) {
+            chart.push(series, Point(i, std::sin(i * 0.01)));
+            if (i % window == window - 1) {
+                buffer.clear();
+                chart.serialize(buffer, layout);
+            }
+        }
+        double seconds = secondsSince(start);
+        report.add("rolling_linechart/" + std::to_string(window), "macro",
+            static_cast<long long>(samples), seconds, static_cast<long long>(buffer.size()));
+    }
+
+    void documentBenchmarks(Report & report, std::size_t max_elements, bool streaming)
+    {
+        std::string const file_name = "simple_svg_bench.svg";
+        for (std::size_t elements = 1000; elements <= max_elements; elements *= 10) {
+            std::mt19937 random(11);
+            std::uniform_real_distribution<double> coordinate(0, 1000);
+
+            long long baseline = heap_current;
+            resetPeak();
+            Clock::time_point start = Clock::now();
+            OutputStats stats;
+            if (streaming) {
+                StreamingDocument doc(file_name, Layout(Dimensions(1000, 1000)));
+                for (std::size_t i = 0; i < elements; ++i)
+                    doc << Circle(Point(coordinate(random), coordinate(random)), 4, Color::Red);
+                doc.close();
+                stats = doc.stats();
+            }
+            else {
+                Document doc(file_name, Layout(Dimensions(1000, 1000)));
+                for (std::size_t i = 0; i < elements; ++i)
+                    doc << Circle(Point(coordinate(random), coordinate(random)), 4, Color::Red);
+                doc.save(&stats);
+            }
+            double seconds = secondsSince(start);
+            report.add(std::string(streaming ? "streaming_document" : "document") + "/"
+                + std::to_string(elements), "macro", static_cast<long long>(elements), seconds,
+                static_cast<long long>(stats.raw_bytes), heap_peak - baseline);
+        }
+        std::remove(file_name.c_str());
+    }
+
+    // Renders one retained scene at two sizes.  The peak heap figure covers
+    //  rendering only, not building the scene.
+    void retainedBenchmarks(Report & report, std::size_t max_elements)
+    {
+        for (std::size_t elements = 1000; elements <= max_elements && elements <= 1000000;
+            elements *= 10) {
+            std::mt19937 random(11);
+            std::uniform_real_distribution<double> coordinate(0, 1000);
+            RetainedDocument doc;
+            for (std::size_t i = 0; i < elements; ++i)
+                doc << Circle(Point(coordinate(random), coordinate(random)), 4, Color::Red);
+
+            Layout layouts[] = { Layout(Dimensions(1000, 1000)),
+                Layout(Dimensions(100, 100), Layout::BottomLeft, 0.1) };
+            std::string buffer;
+            buffer.reserve(elements * 80);
+            long long baseline = heap_current;
+            resetPeak();
+            Clock::time_point start = Clock::now();
+            long long bytes = 0;
+            for (int i = 0; i < 2; ++i) {
+                buffer.clear();
+                doc.render(buffer, layouts[i]);
+                bytes += static_cast<long long>(buffer.size());
+            }
+            double seconds = secondsSince(start);
+            report.add("retained_document/" + std::to_string(elements), "macro",
+                static_cast<long long>(elements) * 2, seconds, bytes, heap_peak - baseline);
+        }
+    }
+
+    // Small circles and rectangles serialized one virtual call at a time,
+    //  and as a ShapeBatch.
+    void batchBenchmarks(Report & report, std::size_t max_elements)
+    {
+        for (std::size_t elements = 1000; elements <= max_elements && elements <= 1000000;
+            elements *= 10) {
+            std::mt19937 random(11);
+            std::uniform_real_distribution<double> coordinate(0, 1000);
+            std::vector<std::unique_ptr<Shape> > shapes;
+            ShapeBatch<Circle, Rectangle> batch;
+            for (std::size_t i = 0; i < elements; ++i) {
+                Point position(coordinate(random), coordinate(random));
+                if (i % 2) {
+                    Circle circle(position, 4, Color::Red);
+                    shapes.push_back(std::unique_ptr<Shape>(circle.clone()));
+                    batch << circle;
+                }
+                else {
+                    Rectangle rectangle(position, 3, 2, Color::Blue);
+                    shapes.push_back(std::unique_ptr<Shape>(rectangle.clone()));
+                    batch << rectangle;
+                }
+            }
+
+            Layout layout(Dimensions(1000, 1000));
+            std::string buffer;
+            Clock::time_point start = Clock::now();
+            for (std::size_t i = 0; i < shapes.size(); ++i)
+                shapes[i]->serialize(buffer, layout);
+            double seconds = secondsSince(start);
+            report.add("shapes_virtual/" + std::to_string(elements), "macro",
+                static_cast<long long>(elements), seconds, static_cast<long long>(buffer.size()));
+
+            buffer = std::string();
+            start = Clock::now();
+            batch.serialize(buffer, layout);
+            seconds = secondsSince(start);
+            report.add("shape_batch/" + std::to_string(elements), "macro",
+                static_cast<long long>(elements), seconds, static_cast<long long>(buffer.size()));
+        }
+    }
+
+    // Small line charts rendered into a tar archive by a BatchRenderer, on
+    //  one thread and on one per core.
+    void batchRendererBenchmarks(Report & report, std::size_t max_elements)
+    {
+        std::string const file_name = "simple_svg_bench.tar";
+        std::size_t const documents = max_elements / 100 < 10000 ? max_elements / 100 : 10000;
+        unsigned const cores = std::max(1u, std::thread::hardware_concurrency());
+        unsigned const thread_counts[] = { 1, cores };
+        for (int run = 0; run < (cores > 1 ? 2 : 1); ++run) {
+            BatchRenderer batch(Layout(Dimensions(400, 200)), thread_counts[run]);
+            for (std::size_t i = 0; i < documents; ++i)
+                batch.add("chart-" + std::to_string(i) + ".svg", [i](BatchDocument & doc) {
+                    std::vector<Point> points;
+                    points.reserve(400);
+                    for (int x = 0; x < 400; ++x)
+                        points.push_back(Point(x, 100 + 90 * std::sin((x + i) * 0.05)));
+                    doc << Polyline(std::move(points), Fill(), Stroke(1, Color::Blue));
+                });
+
+            Clock::time_point start = Clock::now();
+            OutputStats stats;
+            batch.renderArchive(file_name, &stats);
+            double seconds = secondsSince(start);
+            report.add("batch_renderer/" + std::to_string(thread_counts[run]) + "_threads",
+                "macro", static_cast<long long>(documents), seconds,
+                static_cast<long long>(stats.raw_bytes));
+        }
+        std::remove(file_name.c_str());
+    }
+
+    // Scatters circles over a large canvas and writes them as a tile
+    //  pyramid into the working directory, then removes the tiles.
+    void tileBenchmarks(Report & report, std::size_t max_elements)
+    {
+        std::size_t const elements = max_elements < 1000000 ? max_elements : 1000000;
+        std::mt19937 random(13);
+        std::uniform_real_distribution<double> coordinate(0, 4096);
+        TileExporter tiles(Layout(Dimensions(4096, 4096)), 256);
+        for (std::size_t i = 0; i < elements; ++i)
+            tiles << Circle(Point(coordinate(random), coordinate(random)), 4, Color::Red);
+
+        Clock::time_point start = Clock::now();
+        OutputStats stats;
+        tiles.save(".", &stats);
+        double seconds = secondsSince(start);
+        report.add("tile_export/" + std::to_string(elements), "macro",
+            static_cast<long long>(elements), seconds, static_cast<long long>(stats.raw_bytes));
+
+        for (unsigned level = 0, size = 1; level < tiles.levelCount(); ++level, size *= 2)
+            for (unsigned column = 0; column < size; ++column)
+                for (unsigned row = 0; row < size; ++row)
+                    std::remove((std::to_string(level) + '_' + std::to_string(column) + '_'
+                        + std::to_string(row) + ".svg").c_str());
+        std::remove("index.json");
+    }
+
+    // Saves a dashboard-like document repeatedly with one percent of its
+    //  shapes changed between saves.
+    void incrementalBenchmarks(Report & report, std::size_t max_elements)
+    {
+        std::string const file_name = "simple_svg_bench.svg";
+        int const frames = 10;
+        for (std::size_t elements = 1000; elements <= max_elements && elements <= 1000000;
+            elements *= 10) {
+            std::mt19937 random(11);
+            std::uniform_real_distribution<double> coordinate(0, 1000);
+            IncrementalDocument doc(file_name, Layout(Dimensions(1000, 1000)));
+            std::vector<IncrementalDocument::Handle> handles;
+            for (std::size_t i = 0; i < elements; ++i)
+                handles.push_back(doc.add(Circle(Point(coordinate(random), coordinate(random)),
+                    4, Color::Red)));
+            doc.save();
+
+            Clock::time_point start = Clock::now();
+            long long bytes = 0;
+            for (int frame = 0; frame < frames; ++frame) {
+                for (std::size_t i = 0; i < elements / 100; ++i)
+                    doc.replace(handles[random() % elements],
+                        Circle(Point(coordinate(random), coordinate(random)), 4, Color::Blue));
+                OutputStats stats;
+                doc.save(&stats);
+                bytes += static_cast<long long>(stats.raw_bytes);
+            }
+            double seconds = secondsSince(start);
+            report.add("incremental_document/" + std::to_string(elements), "macro", frames,
+                seconds, bytes);
+        }
+        std::remove(file_name.c_str());
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    std::size_t max_elements = 10000000;
+    char const * output = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--max-elements") == 0 && i + 1 < argc)
+            max_elements = static_cast<std::size_t>(std::atof(argv[++i]));
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else {
+            std::fprintf(stderr, "usage: %s [--max-elements N] [--output FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Report report;
+    microBenchmarks(report);
+    lineChartBenchmarks(report, max_elements);
+    rollingChartBenchmarks(report, max_elements);
+    documentBenchmarks(report, max_elements, false);
+    documentBenchmarks(report, max_elements, true);
+    retainedBenchmarks(report, max_elements);
+    incrementalBenchmarks(report, max_elements);
+    batchBenchmarks(report, max_elements);
+    batchRendererBenchmarks(report, max_elements);
+    tileBenchmarks(report, max_elements);
+
+    std::string json = report.finish();
+    if (!output) {
+        std::fputs(json.c_str(), stdout);
+        return 0;
+    }
+    std::ofstream ofs(output);
+    ofs << json;
+    return ofs.good() ? 0 : 1;
+}
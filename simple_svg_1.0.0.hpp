@@ -36,6 +36,53 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <clocale>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <tuple>
+#include <future>
+#include <functional>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+#include <exception>
+#include <typeinfo>
+
+#ifdef SIMPLE_SVG_STATS
+#include <chrono>
+#include <map>
+#endif
+
+#ifdef SIMPLE_SVG_USE_ZLIB
+#include <zlib.h>
+#endif
+
+// writev() file output (FileDescriptorSink) and mmap() file input are
+//  opt-in, so that only programs that define SIMPLE_SVG_USE_POSIX before
+//  including this header get the system headers they need.  Without it,
+//  files go through the standard streams.
+#if defined(SIMPLE_SVG_USE_POSIX) && (defined(__unix__) || defined(__APPLE__))
+#define SIMPLE_SVG_HAS_WRITEV
+#define SIMPLE_SVG_HAS_MMAP
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 #include <iostream>
 
@@ -63,6 +110,371 @@ namespace svg
         return "/>\n";
     }
 
+    // Controls how coordinates and lengths are written.
+    //  Default matches std::ostream (6 significant digits).
+    //  Shortest writes the fewest digits that read back as the same double.
+    //  Fixed rounds to the given number of decimals (0 to 9) and drops
+    //  trailing zeros, so "2 decimals" writes 1.5 as "1.5" and 2.0 as "2".
+    //  All modes write '.' as the decimal separator whatever the C locale is.
+    struct NumberFormat
+    {
+        enum Mode { Default, Shortest, Fixed };
+
+        NumberFormat(Mode mode = Default, int decimals = 2)
+            : mode(mode), decimals(decimals) { }
+        static NumberFormat shortest() { return NumberFormat(Shortest); }
+        static NumberFormat fixed(int decimals) { return NumberFormat(Fixed, decimals); }
+
+        Mode mode;
+        int decimals;
+    };
+
+    // Replaces the decimal separator of the C locale by '.'.
+    inline void fixDecimalPoint(char * buffer, int length)
+    {
+        char const point = *std::localeconv()->decimal_point;
+        if (point == '.')
+            return;
+        for (int i = 0; i < length; ++i)
+            if (buffer[i] == point)
+                buffer[i] = '.';
+    }
+    inline void appendPrintf(std::string & out, char const * format, int precision, double value)
+    {
+        char buffer[352];
+        int length = std::snprintf(buffer, sizeof(buffer), format, precision, value);
+        fixDecimalPoint(buffer, length);
+        out.append(buffer, length);
+    }
+    inline void appendShortest(std::string & out, double value)
+    {
+        char buffer[32];
+        int length = 0;
+        for (int precision = 15; precision <= 17; ++precision) {
+            length = std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            if (std::strtod(buffer, 0) == value)
+                break;
+        }
+        fixDecimalPoint(buffer, length);
+        out.append(buffer, length);
+    }
+    // Writes value / 10^decimals without trailing zeros.  With
+    //  leading_zero false, "0.5" is written as ".5".  decimals is 0 to 9.
+    inline void appendDecimal(std::string & out, long long value, int decimals,
+        bool leading_zero = true)
+    {
+        static long long const units[] = { 1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL,
+            1000000LL, 10000000LL, 100000000LL, 1000000000LL };
+        if (value == 0) {
+            out += '0';
+            return;
+        }
+        if (value < 0) {
+            out += '-';
+            value = -value;
+        }
+
+        // Digits are produced back to front.
+        char buffer[32];
+        char * end = buffer + sizeof(buffer);
+        char * begin = end;
+        long long integer = value / units[decimals];
+        long long fraction = value % units[decimals];
+        bool const has_fraction = fraction != 0;
+        if (has_fraction) {
+            int digits = decimals;
+            while (fraction % 10 == 0) {
+                fraction /= 10;
+                --digits;
+            }
+            for (; digits > 0; --digits) {
+                *--begin = static_cast<char>('0' + fraction % 10);
+                fraction /= 10;
+            }
+            *--begin = '.';
+        }
+        if (integer != 0 || leading_zero || !has_fraction) {
+            do {
+                *--begin = static_cast<char>('0' + integer % 10);
+                integer /= 10;
+            } while (integer != 0);
+        }
+        out.append(begin, end);
+    }
+    inline void appendFixed(std::string & out, double value, int decimals)
+    {
+        static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+        if (decimals < 0)
+            decimals = 0;
+        if (decimals > 9)
+            decimals = 9;
+
+        double scaled = value * powers[decimals];
+        if (!(std::fabs(scaled) < 9e18)) {
+            // Too large for integer arithmetic, or not finite.
+            appendPrintf(out, "%.*g", 17, value);
+            return;
+        }
+
+        appendDecimal(out, std::llround(scaled), decimals);
+    }
+
+    // Writes value like "%.6g".  Values that "%g" writes in fixed notation
+    //  are rounded to six significant digits with integer arithmetic; the
+    //  product used for rounding is within 1e-9 of the exact one, so only
+    //  values that close to a rounding tie go through snprintf, as do values
+    //  written in exponent notation, zero and non-finite values.
+    inline void appendGeneral(std::string & out, double value)
+    {
+        static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+        double magnitude = std::fabs(value);
+        if (!(magnitude >= 1e-5 && magnitude < 1e7)) {
+            appendPrintf(out, "%.*g", 6, value);
+            return;
+        }
+
+        // Find the decimal exponent of value after rounding to six digits.
+        int exponent = static_cast<int>(std::floor(std::log10(magnitude)));
+        double rounded = 0;
+        for (int attempt = 0; attempt < 3; ++attempt) {
+            if (exponent < -4 || exponent > 5)
+                break;
+            double scaled = magnitude * powers[5 - exponent];
+            if (std::fabs(scaled - std::floor(scaled) - 0.5) < 1e-9)
+                break;
+            rounded = std::floor(scaled + 0.5);
+            if (rounded < 100000)
+                --exponent;
+            else if (rounded >= 1000000)
+                ++exponent;
+            else
+                break;
+        }
+        if (exponent < -4 || exponent > 5 || rounded < 100000 || rounded >= 1000000) {
+            appendPrintf(out, "%.*g", 6, value);
+            return;
+        }
+
+        long long digits = static_cast<long long>(rounded);
+        appendDecimal(out, value < 0 ? -digits : digits, 5 - exponent);
+    }
+
+    // Append counterparts of the functions above.  They write into a buffer
+    //  owned by the caller, so a buffer that is cleared and reused stops
+    //  allocating once it has grown to fit the largest element.
+    inline void appendNumber(std::string & out, double value,
+        NumberFormat const & format = NumberFormat())
+    {
+        switch (format.mode)
+        {
+            case NumberFormat::Shortest: appendShortest(out, value); break;
+            case NumberFormat::Fixed: appendFixed(out, value, format.decimals); break;
+            // "%g" matches the default formatting of std::ostream.
+            default: appendGeneral(out, value); break;
+        }
+    }
+    inline void appendNumber(std::string & out, int value)
+    {
+        appendDecimal(out, value, 0);
+    }
+    // Formats like attribute() above without going through a std::stringstream.
+    inline std::string attribute(std::string const & attribute_name,
+        double value, std::string const & unit = "")
+    {
+        std::string out = attribute_name;
+        out += "=\"";
+        appendNumber(out, value);
+        out += unit;
+        out += "\" ";
+        return out;
+    }
+    inline void appendAttribute(std::string & out, char const * attribute_name,
+        double value, NumberFormat const & format = NumberFormat(), char const * unit = "")
+    {
+        out += attribute_name;
+        out += "=\"";
+        appendNumber(out, value, format);
+        out += unit;
+        out += "\" ";
+    }
+    // Length of the run at the start of text that needs no escaping, see
+    //  appendEscaped().  Eight bytes are tested at a time: a byte of
+    //  x ^ (ones * c) is zero where x has c, and (y - ones) & ~y & highs is
+    //  non-zero exactly if a byte of y is.
+    inline std::size_t escapeFreeLength(char const * text, std::size_t length, bool in_attribute)
+    {
+        std::uint64_t const ones = 0x0101010101010101ULL;
+        std::uint64_t const highs = 0x8080808080808080ULL;
+        // Outside attributes the quote test looks for '&' a second time.
+        std::uint64_t const quotes = ones * static_cast<unsigned char>(in_attribute ? '"' : '&');
+        std::size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, text + i, 8);
+            std::uint64_t amp = word ^ (ones * '&');
+            std::uint64_t lt = word ^ (ones * '<');
+            std::uint64_t quote = word ^ quotes;
+            if ((((amp - ones) & ~amp) | ((lt - ones) & ~lt) | ((quote - ones) & ~quote)) & highs)
+                break;
+        }
+        for (; i < length; ++i)
+            if (text[i] == '&' || text[i] == '<' || (text[i] == '"' && in_attribute))
+                break;
+        return i;
+    }
+    // Appends text with the characters XML does not allow there replaced by
+    //  entities: '&' and '<' everywhere, and '"' as well in attribute values.
+    //  Text without them is copied with a single append after a scan of
+    //  eight bytes at a time, so it costs little more than a plain copy.
+    inline void appendEscaped(std::string & out, char const * text, std::size_t length,
+        bool in_attribute)
+    {
+        std::size_t i = escapeFreeLength(text, length, in_attribute);
+        out.append(text, i);
+        if (i == length)
+            return;
+
+        // Escape the rest into room for the worst case of six bytes per
+        //  character, copying the clean runs in between whole.
+        std::size_t start = out.size();
+        out.resize(start + (length - i) * 6);
+        char * target = &out[start];
+        while (i < length) {
+            if (text[i] == '&') {
+                std::memcpy(target, "&amp;", 5);
+                target += 5;
+            }
+            else if (text[i] == '<') {
+                std::memcpy(target, "&lt;", 4);
+                target += 4;
+            }
+            else {
+                std::memcpy(target, "&quot;", 6);
+                target += 6;
+            }
+            ++i;
+            std::size_t run = escapeFreeLength(text + i, length - i, in_attribute);
+            std::memcpy(target, text + i, run);
+            target += run;
+            i += run;
+        }
+        out.resize(target - out.data());
+    }
+    // Replaces the entities of XML text by the characters they stand for.
+    //  Unknown entities and malformed character references are copied as
+    //  they are.  References to characters that cannot appear in UTF-8 text,
+    //  i.e. NUL, surrogates and code points above U+10FFFF, become U+FFFD.
+    inline void appendUnescaped(std::string & out, char const * text, std::size_t length)
+    {
+        char const * end = text + length;
+        while (text < end) {
+            char const * amp = static_cast<char const *>(std::memchr(text, '&', end - text));
+            if (!amp) {
+                out.append(text, end);
+                return;
+            }
+            out.append(text, amp);
+            char const * semicolon = static_cast<char const *>(std::memchr(amp, ';', end - amp));
+            if (!semicolon) {
+                out.append(amp, end);
+                return;
+            }
+            std::string name(amp + 1, semicolon);
+            text = semicolon + 1;
+            if (name == "amp")
+                out += '&';
+            else if (name == "lt")
+                out += '<';
+            else if (name == "gt")
+                out += '>';
+            else if (name == "quot")
+                out += '"';
+            else if (name == "apos")
+                out += '\'';
+            else if (name.size() > 1 && name[0] == '#') {
+                bool hex = name[1] == 'x';
+                char const * digits = name.c_str() + (hex ? 2 : 1);
+                char * digits_end = 0;
+                unsigned long code = std::strtoul(digits, &digits_end, hex ? 16 : 10);
+                if (digits_end == digits || *digits_end || !std::isxdigit(
+                    static_cast<unsigned char>(*digits))) {
+                    out.append(amp, text);
+                    continue;
+                }
+                if (code == 0 || code > 0x10ffff || (code >= 0xd800 && code < 0xe000))
+                    code = 0xfffd;
+                // As UTF-8.
+                if (code < 0x80)
+                    out += static_cast<char>(code);
+                else if (code < 0x800) {
+                    out += static_cast<char>(0xc0 | (code >> 6));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                }
+                else if (code < 0x10000) {
+                    out += static_cast<char>(0xe0 | (code >> 12));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                }
+                else {
+                    out += static_cast<char>(0xf0 | (code >> 18));
+                    out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                }
+            }
+            else
+                out.append(amp, text);
+        }
+    }
+    inline void appendAttribute(std::string & out, char const * attribute_name,
+        char const * value)
+    {
+        out += attribute_name;
+        out += "=\"";
+        appendEscaped(out, value, std::strlen(value), true);
+        out += "\" ";
+    }
+    inline void appendAttribute(std::string & out, char const * attribute_name,
+        std::string const & value)
+    {
+        out += attribute_name;
+        out += "=\"";
+        appendEscaped(out, value.data(), value.size(), true);
+        out += "\" ";
+    }
+    // String values of attribute() are escaped like those of appendAttribute().
+    inline std::string attribute(std::string const & attribute_name,
+        std::string const & value, std::string const & unit = "")
+    {
+        std::string out = attribute_name;
+        out += "=\"";
+        appendEscaped(out, value.data(), value.size(), true);
+        out += unit;
+        out += "\" ";
+        return out;
+    }
+    inline std::string attribute(std::string const & attribute_name,
+        char const * value, std::string const & unit = "")
+    {
+        return attribute(attribute_name, std::string(value), unit);
+    }
+    inline void appendElemStart(std::string & out, char const * element_name)
+    {
+        out += "\t<";
+        out += element_name;
+        out += ' ';
+    }
+    inline void appendElemEnd(std::string & out, char const * element_name)
+    {
+        out += "</";
+        out += element_name;
+        out += ">\n";
+    }
+    inline void appendEmptyElemEnd(std::string & out)
+    {
+        out += "/>\n";
+    }
+
     // Quick optional return type.  This allows functions to return an invalid
     //  value if no good return is possible.  The user checks for validity
     //  before using the returned value.
@@ -131,18 +543,113 @@ namespace svg
         return optional<Point>(max);
     }
 
+    // Axis aligned bounding box of a set of points.  Starts out empty.
+    struct Bounds
+    {
+        Bounds() : empty(true) { }
+        Bounds(Point const & min, Point const & max) : empty(false), min(min), max(max) { }
+        void extend(Point const & point)
+        {
+            if (empty) {
+                min = max = point;
+                empty = false;
+                return;
+            }
+            if (point.x < min.x)
+                min.x = point.x;
+            if (point.y < min.y)
+                min.y = point.y;
+            if (point.x > max.x)
+                max.x = point.x;
+            if (point.y > max.y)
+                max.y = point.y;
+        }
+        void extend(Bounds const & other)
+        {
+            if (other.empty)
+                return;
+            extend(other.min);
+            extend(other.max);
+        }
+        void offset(Point const & offset)
+        {
+            min.x += offset.x;
+            min.y += offset.y;
+            max.x += offset.x;
+            max.y += offset.y;
+        }
+        // False if either box is empty.
+        bool intersects(Bounds const & other) const
+        {
+            return !empty && !other.empty && min.x <= other.max.x && other.min.x <= max.x
+                && min.y <= other.max.y && other.min.y <= max.y;
+        }
+        bool empty;
+        Point min;
+        Point max;
+    };
+
+    // How point lists and path data are written.  Absolute writes every point
+    //  as "x,y ".  Compact writes the shortest form SVG accepts: coordinates
+    //  are snapped to a grid of `quantum` output pixels, points that snap to
+    //  the position of the previous point are dropped, leading zeros and
+    //  redundant separators are left out, and path data uses the relative
+    //  commands l, h and v.  Compact ignores the number format.
+    struct PointEncoding
+    {
+        enum Mode { Absolute, Compact };
+
+        PointEncoding(Mode mode = Absolute, double quantum = 0.01)
+            : mode(mode), quantum(quantum) { }
+        static PointEncoding compact(double quantum = 0.01) { return PointEncoding(Compact, quantum); }
+
+        Mode mode;
+        double quantum;
+    };
+
+    class StyleSheet;
+    class SymbolTable;
+#ifdef SIMPLE_SVG_STATS
+    class SerializationStats;
+#endif
+
     // Defines the dimensions, scale, origin, and origin offset of the document.
+    //  style_sheet is set by documents that share styles between elements,
+    //  symbols by documents that collect the definitions shapes register
+    //  while serializing, stats by documents that collect serialization
+    //  statistics.
     struct Layout
     {
         enum Origin { TopLeft, BottomLeft, TopRight, BottomRight };
 
         Layout(Dimensions const & dimensions = Dimensions(400, 300), Origin origin = BottomLeft,
-            double scale = 1, Point const & origin_offset = Point(0, 0))
-            : dimensions(dimensions), scale(scale), origin(origin), origin_offset(origin_offset) { }
+            double scale = 1, Point const & origin_offset = Point(0, 0),
+            NumberFormat const & number_format = NumberFormat(),
+            PointEncoding const & point_encoding = PointEncoding())
+            : dimensions(dimensions), scale(scale), origin(origin), origin_offset(origin_offset),
+            number_format(number_format), point_encoding(point_encoding), style_sheet(0),
+            symbols(0), culling(false), group_scale(1)
+#ifdef SIMPLE_SVG_STATS
+            , stats(0)
+#endif
+            { }
         Dimensions dimensions;
         double scale;
         Origin origin;
         Point origin_offset;
+        NumberFormat number_format;
+        PointEncoding point_encoding;
+        StyleSheet * style_sheet;
+        SymbolTable * symbols;
+        // Leave out shapes that fall entirely outside the canvas, and collapse
+        //  the off-canvas parts of polylines and paths.
+        bool culling;
+        // Scale the viewer applies on top of this layout, through the
+        //  transforms of enclosing Groups.  1 outside of groups.
+        double group_scale;
+#ifdef SIMPLE_SVG_STATS
+        SerializationStats * stats;
+#endif
     };
 
     // Convert coordinates in user space to SVG native space.
@@ -166,12 +673,534 @@ namespace svg
         return dimension * layout.scale;
     }
 
+    // Layout with the origin fixed at compile time, for code that maps many
+    //  coordinates: the branches on the origin in translateX/Y are resolved
+    //  when the template is instantiated instead of once per coordinate.
+    //  The arithmetic is the same, so results are bit-identical.
+    template <Layout::Origin O>
+    struct StaticLayout
+    {
+        static bool const flip_x = O == Layout::BottomRight || O == Layout::TopRight;
+        static bool const flip_y = O == Layout::BottomLeft || O == Layout::BottomRight;
+
+        explicit StaticLayout(Layout const & layout) : layout(layout) { }
+        double x(double x) const
+        {
+            return flip_x ? layout.dimensions.width - ((x + layout.origin_offset.x) * layout.scale)
+                : (layout.origin_offset.x + x) * layout.scale;
+        }
+        double y(double y) const
+        {
+            return flip_y ? layout.dimensions.height - ((y + layout.origin_offset.y) * layout.scale)
+                : (layout.origin_offset.y + y) * layout.scale;
+        }
+
+        Layout const & layout;
+    };
+
+    // Calls function with the StaticLayout for the origin of layout, so
+    //  function needs a call operator templated on the layout type.
+    template <typename Function>
+    inline void withStaticLayout(Layout const & layout, Function const & function)
+    {
+        switch (layout.origin)
+        {
+            case Layout::TopLeft: function(StaticLayout<Layout::TopLeft>(layout)); break;
+            case Layout::BottomLeft: function(StaticLayout<Layout::BottomLeft>(layout)); break;
+            case Layout::TopRight: function(StaticLayout<Layout::TopRight>(layout)); break;
+            case Layout::BottomRight: function(StaticLayout<Layout::BottomRight>(layout)); break;
+        }
+    }
+
+    // Layout that draws a point p where layout draws p + shift, for moving
+    //  shapes without touching their coordinates.  Results may differ from
+    //  moving the coordinates in the last bit, since the additions happen in
+    //  a different order.
+    inline Layout shiftedLayout(Layout const & layout, Point const & shift)
+    {
+        Layout shifted = layout;
+        shifted.origin_offset.x += shift.x;
+        shifted.origin_offset.y += shift.y;
+        return shifted;
+    }
+
+    // Part of user space that lands on the canvas, grown by margin on every
+    //  side.  Empty if the layout does not have a positive scale.
+    inline Bounds visibleArea(Layout const & layout, double margin = 0)
+    {
+        if (layout.scale <= 0)
+            return Bounds();
+        return Bounds(
+            Point(-layout.origin_offset.x - margin, -layout.origin_offset.y - margin),
+            Point(layout.dimensions.width / layout.scale - layout.origin_offset.x + margin,
+                layout.dimensions.height / layout.scale - layout.origin_offset.y + margin));
+    }
+
+    // Strided, read-only view of x and y coordinates.  Covers Point arrays,
+    //  where x and y are interleaved, as well as separate x and y arrays.
+    //  The stride is counted in doubles.
+    struct CoordinateView
+    {
+        CoordinateView(Point const * points, std::size_t count)
+            : xs(points ? &points->x : 0), ys(points ? &points->y : 0), count(count),
+            stride(sizeof(Point) / sizeof(double)) { }
+        CoordinateView(double const * xs, double const * ys, std::size_t count,
+            std::size_t stride = 1)
+            : xs(xs), ys(ys), count(count), stride(stride) { }
+        double x(std::size_t i) const { return xs[i * stride]; }
+        double y(std::size_t i) const { return ys[i * stride]; }
+        CoordinateView slice(std::size_t first, std::size_t size) const
+        {
+            return CoordinateView(xs + first * stride, ys + first * stride, size, stride);
+        }
+
+        double const * xs;
+        double const * ys;
+        std::size_t count;
+        std::size_t stride;
+    };
+
+    inline Bounds boundsOf(CoordinateView const & points)
+    {
+        Bounds bounds;
+        for (std::size_t i = 0; i < points.count; ++i)
+            bounds.extend(Point(points.x(i), points.y(i)));
+        return bounds;
+    }
+
+    // Keeps the indices of the points needed to draw the part of the line
+    //  through points that lies in area.  A run of consecutive points that
+    //  are all beyond the same edge of area only produces segments beyond
+    //  that edge, so it is reduced to its first and last point.  Removing it
+    //  changes neither the visible part of the line nor, since the region
+    //  beyond the edge is convex, what a closed path fills inside area.
+    inline void collapseOutside(CoordinateView const & points, Bounds const & area,
+        std::vector<std::size_t> & kept)
+    {
+        struct Outcode
+        {
+            static unsigned of(CoordinateView const & points, std::size_t i, Bounds const & area)
+            {
+                double x = points.x(i);
+                double y = points.y(i);
+                return (x < area.min.x ? 1u : 0u) | (x > area.max.x ? 2u : 0u)
+                    | (y < area.min.y ? 4u : 0u) | (y > area.max.y ? 8u : 0u);
+            }
+        };
+        std::size_t const count = points.count;
+        std::size_t i = 0;
+        while (i < count) {
+            unsigned common = Outcode::of(points, i, area);
+            kept.push_back(i);
+            if (!common) {
+                ++i;
+                continue;
+            }
+            std::size_t last = i;
+            while (last + 1 < count && (common & Outcode::of(points, last + 1, area))) {
+                common &= Outcode::of(points, last + 1, area);
+                ++last;
+            }
+            if (last > i)
+                kept.push_back(last);
+            i = last + 1;
+        }
+    }
+
+    // One axis of translatePoints().  Same arithmetic as translateX/Y, so
+    //  results are bit-identical.
+    template <bool Flip>
+    inline void translateAxis(double const * in, std::size_t stride, std::size_t count,
+        double offset, double scale, double extent, double * out)
+    {
+        if (stride == 1) {
+            for (std::size_t i = 0; i < count; ++i)
+                out[i] = Flip ? extent - ((in[i] + offset) * scale) : (offset + in[i]) * scale;
+        }
+        else {
+            for (std::size_t i = 0; i < count; ++i)
+                out[i] = Flip ? extent - ((in[i * stride] + offset) * scale)
+                    : (offset + in[i * stride]) * scale;
+        }
+    }
+
+    // Maps a whole coordinate array to output space, writing x and y into
+    //  separate arrays.  The inner loops are branch free and can be
+    //  vectorized.
+    template <Layout::Origin O>
+    inline void translatePoints(CoordinateView const & points, StaticLayout<O> const & mapping,
+        double * xs, double * ys)
+    {
+        Layout const & layout = mapping.layout;
+        translateAxis<StaticLayout<O>::flip_x>(points.xs, points.stride, points.count,
+            layout.origin_offset.x, layout.scale, layout.dimensions.width, xs);
+        translateAxis<StaticLayout<O>::flip_y>(points.ys, points.stride, points.count,
+            layout.origin_offset.y, layout.scale, layout.dimensions.height, ys);
+    }
+
+    // Function object for withStaticLayout().
+    struct TranslatePoints
+    {
+        TranslatePoints(CoordinateView const & points, double * xs, double * ys)
+            : points(points), xs(xs), ys(ys) { }
+        template <typename Mapping>
+        void operator()(Mapping const & mapping) const
+        {
+            translatePoints(points, mapping, xs, ys);
+        }
+
+        CoordinateView const & points;
+        double * xs;
+        double * ys;
+    };
+
+    // Resolves the origin once per call.
+    inline void translatePoints(CoordinateView const & points, Layout const & layout,
+        double * xs, double * ys)
+    {
+        withStaticLayout(layout, TranslatePoints(points, xs, ys));
+    }
+
+    // Optional reduction of dense point series, done in output space so that
+    //  the result depends on how many pixels the data covers.
+    //  MinMax splits the points into columns `tolerance` output pixels wide
+    //  and keeps the first, lowest, highest and last point of each column,
+    //  which preserves spikes.  LargestTriangle (LTTB) keeps one point per
+    //  `tolerance` pixels of width, picking the one that spans the largest
+    //  triangle with its neighbours, which preserves the overall shape.
+    struct Decimation
+    {
+        enum Method { None, MinMax, LargestTriangle };
+
+        Decimation(Method method = None, double tolerance = 1)
+            : method(method), tolerance(tolerance) { }
+        static Decimation minMax(double tolerance = 1) { return Decimation(MinMax, tolerance); }
+        static Decimation largestTriangle(double tolerance = 1)
+        {
+            return Decimation(LargestTriangle, tolerance);
+        }
+
+        Method method;
+        double tolerance;
+    };
+
+    template <typename Mapping>
+    inline void decimateMinMax(CoordinateView const & points, Mapping const & mapping,
+        double tolerance, std::vector<std::size_t> & kept)
+    {
+        std::size_t const count = points.count;
+        std::size_t first = 0;
+        while (first < count) {
+            double column = std::floor(mapping.x(points.x(first)) / tolerance);
+            std::size_t low = first, high = first, last = first;
+            while (last + 1 < count
+                && std::floor(mapping.x(points.x(last + 1)) / tolerance) == column) {
+                ++last;
+                if (points.y(last) < points.y(low))
+                    low = last;
+                if (points.y(last) > points.y(high))
+                    high = last;
+            }
+
+            std::size_t lower = low < high ? low : high;
+            std::size_t upper = low < high ? high : low;
+            kept.push_back(first);
+            if (lower != first)
+                kept.push_back(lower);
+            if (upper != lower && upper != last)
+                kept.push_back(upper);
+            if (last != first)
+                kept.push_back(last);
+            first = last + 1;
+        }
+    }
+
+    template <typename Mapping>
+    inline void decimateLargestTriangle(CoordinateView const & points, Mapping const & mapping,
+        double tolerance, std::vector<std::size_t> & kept)
+    {
+        std::size_t const count = points.count;
+        double min_x = mapping.x(points.x(0));
+        double max_x = min_x;
+        for (std::size_t i = 1; i < count; ++i) {
+            double x = mapping.x(points.x(i));
+            if (x < min_x)
+                min_x = x;
+            if (x > max_x)
+                max_x = x;
+        }
+        double buckets = std::ceil((max_x - min_x) / tolerance);
+        if (buckets + 2 >= count) {
+            for (std::size_t i = 0; i < count; ++i)
+                kept.push_back(i);
+            return;
+        }
+        if (buckets < 1)
+            buckets = 1;
+
+        // Bucket i covers [1 + i * every, 1 + (i + 1) * every); the first and
+        //  last points are always kept.
+        double every = (count - 2) / buckets;
+        std::size_t selected = 0;
+        kept.push_back(0);
+        for (std::size_t bucket = 0; bucket < buckets; ++bucket) {
+            std::size_t begin = 1 + static_cast<std::size_t>(bucket * every);
+            std::size_t end = 1 + static_cast<std::size_t>((bucket + 1) * every);
+            if (end > count - 1)
+                end = count - 1;
+            if (begin >= end)
+                continue;
+
+            // Average of the next bucket, or the last point for the final one.
+            std::size_t next_end = 1 + static_cast<std::size_t>((bucket + 2) * every);
+            if (next_end > count - 1)
+                next_end = count - 1;
+            double average_x = 0, average_y = 0;
+            if (end < next_end) {
+                for (std::size_t i = end; i < next_end; ++i) {
+                    average_x += mapping.x(points.x(i));
+                    average_y += mapping.y(points.y(i));
+                }
+                average_x /= next_end - end;
+                average_y /= next_end - end;
+            }
+            else {
+                average_x = mapping.x(points.x(count - 1));
+                average_y = mapping.y(points.y(count - 1));
+            }
+
+            double selected_x = mapping.x(points.x(selected));
+            double selected_y = mapping.y(points.y(selected));
+            double max_area = -1;
+            for (std::size_t i = begin; i < end; ++i) {
+                double x = mapping.x(points.x(i));
+                double y = mapping.y(points.y(i));
+                double area = std::fabs((selected_x - average_x) * (y - selected_y)
+                    - (selected_x - x) * (average_y - selected_y));
+                if (area > max_area) {
+                    max_area = area;
+                    selected = i;
+                }
+            }
+            kept.push_back(selected);
+        }
+        kept.push_back(count - 1);
+    }
+
+    // Function object for withStaticLayout().
+    struct Decimate
+    {
+        Decimate(CoordinateView const & points, Decimation const & decimation,
+            std::vector<std::size_t> & kept)
+            : points(points), decimation(decimation), kept(kept) { }
+        template <typename Mapping>
+        void operator()(Mapping const & mapping) const
+        {
+            if (decimation.method == Decimation::MinMax)
+                decimateMinMax(points, mapping, decimation.tolerance, kept);
+            else
+                decimateLargestTriangle(points, mapping, decimation.tolerance, kept);
+        }
+
+        CoordinateView const & points;
+        Decimation const & decimation;
+        std::vector<std::size_t> & kept;
+    };
+
+    // Appends the indices of the points to keep, in increasing order.
+    inline void decimate(CoordinateView const & points, Layout const & layout,
+        Decimation const & decimation, std::vector<std::size_t> & kept)
+    {
+        std::size_t const count = points.count;
+        if (count < 3 || decimation.method == Decimation::None || !(decimation.tolerance > 0)) {
+            for (std::size_t i = 0; i < count; ++i)
+                kept.push_back(i);
+            return;
+        }
+
+        withStaticLayout(layout, Decimate(points, decimation, kept));
+    }
+    inline void decimate(Point const * points, std::size_t count, Layout const & layout,
+        Decimation const & decimation, std::vector<std::size_t> & kept)
+    {
+        decimate(CoordinateView(points, count), layout, decimation, kept);
+    }
+
+#ifdef SIMPLE_SVG_STATS
+    // Counts what serialization produces, per element type.  Attach one to a
+    //  document with setStats(); only available when SIMPLE_SVG_STATS is
+    //  defined, so that builds without it pay nothing.  Elements nested in
+    //  other elements, like the polylines of a LineChart, are counted under
+    //  both types.  Safe to share between threads.
+    class SerializationStats
+    {
+    public:
+        struct Entry
+        {
+            Entry() : count(0), bytes(0), points(0), nanoseconds(0) { }
+            unsigned long long count;
+            unsigned long long bytes;
+            unsigned long long points;
+            unsigned long long nanoseconds;
+        };
+
+        SerializationStats() : saves(0), save_bytes(0), save_nanoseconds(0) { }
+
+        void record(char const * element, unsigned long long bytes, unsigned long long points,
+            unsigned long long nanoseconds)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry & entry = entries[element];
+            ++entry.count;
+            entry.bytes += bytes;
+            entry.points += points;
+            entry.nanoseconds += nanoseconds;
+        }
+        void recordSave(unsigned long long bytes, unsigned long long nanoseconds)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++saves;
+            save_bytes += bytes;
+            save_nanoseconds += nanoseconds;
+        }
+
+        // Counters for one element type, all zero if none was serialized.
+        Entry element(std::string const & name) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::map<std::string, Entry>::const_iterator found = entries.find(name);
+            return found == entries.end() ? Entry() : found->second;
+        }
+        std::map<std::string, Entry> elements() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return entries;
+        }
+        unsigned long long saveCount() const { std::lock_guard<std::mutex> lock(mutex); return saves; }
+        unsigned long long saveBytes() const { std::lock_guard<std::mutex> lock(mutex); return save_bytes; }
+        unsigned long long saveNanoseconds() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return save_nanoseconds;
+        }
+
+        std::string toJson() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            char line[256];
+            std::string json = "{\n  \"elements\": {";
+            for (std::map<std::string, Entry>::const_iterator it = entries.begin();
+                it != entries.end(); ++it) {
+                std::snprintf(line, sizeof(line),
+                    "%s\n    \"%s\": {\"count\": %llu, \"bytes\": %llu, \"points\": %llu, "
+                    "\"nanoseconds\": %llu}", it == entries.begin() ? "" : ",", it->first.c_str(),
+                    it->second.count, it->second.bytes, it->second.points, it->second.nanoseconds);
+                json += line;
+            }
+            std::snprintf(line, sizeof(line),
+                "\n  },\n  \"save\": {\"count\": %llu, \"bytes\": %llu, \"nanoseconds\": %llu}\n}\n",
+                saves, save_bytes, save_nanoseconds);
+            json += line;
+            return json;
+        }
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            saves = save_bytes = save_nanoseconds = 0;
+        }
+    private:
+        mutable std::mutex mutex;
+        std::map<std::string, Entry> entries;
+        unsigned long long saves;
+        unsigned long long save_bytes;
+        unsigned long long save_nanoseconds;
+    };
+
+    // Records one element into the stats of the layout, if any, when it goes
+    //  out of scope.  Shapes with point lists pass the number of points they
+    //  wrote, after culling, decimation and compact encoding, to setPoints().
+    class StatsScope
+    {
+    public:
+        StatsScope(Layout const & layout, char const * element, std::string const & out)
+            : stats(layout.stats), element(element), out(out), start_size(out.size()),
+            points(0)
+        {
+            if (stats)
+                start = std::chrono::steady_clock::now();
+        }
+        void setPoints(std::size_t points)
+        {
+            this->points = points;
+        }
+        ~StatsScope()
+        {
+            if (!stats)
+                return;
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+            stats->record(element, out.size() - start_size, points,
+                static_cast<unsigned long long>(elapsed.count()));
+        }
+    private:
+        SerializationStats * stats;
+        char const * element;
+        std::string const & out;
+        std::size_t start_size;
+        std::size_t points;
+        std::chrono::steady_clock::time_point start;
+    };
+#else
+    // Does nothing unless SIMPLE_SVG_STATS is defined.
+    class StatsScope
+    {
+    public:
+        StatsScope(Layout const &, char const *, std::string const &) { }
+        void setPoints(std::size_t) { }
+    };
+#endif
+
     class Serializeable
     {
     public:
         Serializeable() { }
         virtual ~Serializeable() { };
-        virtual std::string toString(Layout const & layout) const = 0;
+        // Subclasses override at least one of serialize() and toString().
+        //  serialize() appends to out and never clears it, so a single buffer
+        //  can be reused for any number of calls; it is what documents call.
+        //  Subclasses written against toString() alone keep working, at the
+        //  cost of a temporary string per call.  One that overrides neither
+        //  throws std::logic_error instead of recursing.
+        virtual void serialize(std::string & out, Layout const & layout) const
+        {
+            out += toString(layout);
+        }
+        virtual std::string toString(Layout const & layout) const
+        {
+            Serializeable const * & current = currentToString();
+            if (current == this)
+                throw std::logic_error("svg: Serializeable subclass overrides neither "
+                    "serialize() nor toString()");
+            // Restores the outer object, also when serialize() throws, since
+            //  the default toString() of one object may run inside another's.
+            struct Restore
+            {
+                Serializeable const * & current;
+                Serializeable const * outer;
+                ~Restore() { current = outer; }
+            } restore = { current, current };
+            current = this;
+            std::string out;
+            serialize(out, layout);
+            return out;
+        }
+    private:
+        // The object whose default toString() is running on this thread.
+        static Serializeable const * & currentToString()
+        {
+            static thread_local Serializeable const * current = 0;
+            return current;
+        }
     };
 
     class Color : public Serializeable
@@ -205,14 +1234,19 @@ namespace svg
             }
         }
         virtual ~Color() { }
-        std::string toString(Layout const &) const
+        void serialize(std::string & out, Layout const &) const
         {
-            std::stringstream ss;
-            if (transparent)
-                ss << "none";
-            else
-                ss << "rgb(" << red << "," << green << "," << blue << ")";
-            return ss.str();
+            if (transparent) {
+                out += "none";
+                return;
+            }
+            out += "rgb(";
+            appendNumber(out, red);
+            out += ',';
+            appendNumber(out, green);
+            out += ',';
+            appendNumber(out, blue);
+            out += ')';
         }
     private:
             bool transparent;
@@ -234,11 +1268,11 @@ namespace svg
         Fill(Color::Defaults color) : color(color) { }
         Fill(Color color = Color::Transparent)
             : color(color) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << attribute("fill", color.toString(layout));
-            return ss.str();
+            out += "fill=\"";
+            color.serialize(out, layout);
+            out += "\" ";
         }
     private:
         Color color;
@@ -249,18 +1283,25 @@ namespace svg
     public:
         Stroke(double width = -1, Color color = Color::Transparent, bool nonScalingStroke = false)
             : width(width), color(color), nonScaling(nonScalingStroke) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
             // If stroke width is invalid.
             if (width < 0)
-                return std::string();
+                return;
 
-            std::stringstream ss;
-            ss << attribute("stroke-width", translateScale(width, layout)) << attribute("stroke", color.toString(layout));
+            // The viewer does not scale non-scaling strokes with a Group, so
+            //  they carry its scale themselves.
+            double scale = nonScaling ? layout.group_scale : 1;
+            appendAttribute(out, "stroke-width", translateScale(width, layout) * scale,
+                layout.number_format);
+            out += "stroke=\"";
+            color.serialize(out, layout);
+            out += "\" ";
             if (nonScaling)
-               ss << attribute("vector-effect", "non-scaling-stroke");
-            return ss.str();
+               appendAttribute(out, "vector-effect", "non-scaling-stroke");
         }
+        double getWidth() const { return width; }
+        bool isNonScaling() const { return nonScaling; }
     private:
         double width;
         Color color;
@@ -271,35 +1312,540 @@ namespace svg
     {
     public:
         Font(double size = 12, std::string const & family = "Verdana") : size(size), family(family) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            serialize(out, layout, size, family.c_str());
+        }
+        static void serialize(std::string & out, Layout const & layout, double size,
+            char const * family)
         {
-            std::stringstream ss;
-            ss << attribute("font-size", translateScale(size, layout)) << attribute("font-family", family);
-            return ss.str();
+            appendAttribute(out, "font-size", translateScale(size, layout), layout.number_format);
+            appendAttribute(out, "font-family", family);
         }
+        double getSize() const { return size; }
+        std::string const & getFamily() const { return family; }
     private:
         double size;
         std::string family;
     };
 
+    // Writes the numbers and commands of PointEncoding::Compact.  Numbers
+    //  are counted in grid steps, so relative moves add up exactly.
+    class CompactEncoder
+    {
+    public:
+        CompactEncoder(std::string & out, double quantum)
+            : out(out), decimals(0), separate(false), previous_has_point(false)
+        {
+            // Express the quantum as unit / 10^decimals.
+            if (!(quantum >= 1e-6))
+                quantum = 1e-6;
+            double scaled = quantum;
+            while (decimals < 6 && std::fabs(scaled - std::floor(scaled + 0.5)) > 1e-9 * scaled) {
+                scaled *= 10;
+                ++decimals;
+            }
+            unit = std::llround(scaled);
+            if (unit < 1)
+                unit = 1;
+            this->quantum = static_cast<double>(unit);
+            for (int i = 0; i < decimals; ++i)
+                this->quantum /= 10;
+        }
+        long long snap(double value) const
+        {
+            return std::llround(value / quantum);
+        }
+        void number(long long steps)
+        {
+            std::size_t start = out.size();
+            appendDecimal(out, steps * unit, decimals, false);
+            char first = out[start];
+            bool has_point = out.find('.', start) != std::string::npos;
+
+            // A separator is only needed where the number would otherwise
+            //  read as a continuation of the previous one.
+            if (separate && first != '-' && !(first == '.' && previous_has_point))
+                out.insert(start, 1, ' ');
+            separate = true;
+            previous_has_point = has_point;
+        }
+        void command(char name)
+        {
+            out += name;
+            separate = false;
+        }
+    private:
+        std::string & out;
+        double quantum;
+        long long unit;
+        int decimals;
+        bool separate;
+        bool previous_has_point;
+    };
+
+    // Calls visit(x, y) with the output-space coordinates of every point.
+    //  Points are mapped in blocks through translatePoints() into buffers on
+    //  the stack.
+    template <typename Visit>
+    inline void forEachTranslatedPoint(CoordinateView const & points, Layout const & layout,
+        Visit visit)
+    {
+        std::size_t const block = 256;
+        double xs[block];
+        double ys[block];
+        for (std::size_t first = 0; first < points.count; first += block) {
+            std::size_t size = points.count - first < block ? points.count - first : block;
+            translatePoints(points.slice(first, size), layout, xs, ys);
+            for (std::size_t i = 0; i < size; ++i)
+                visit(xs[i], ys[i]);
+        }
+    }
+
+    // Appends the points in output space in the form the layout's point
+    //  encoding selects, for a points attribute.  Returns the number of
+    //  points written, which the compact encoding may make smaller.
+    inline std::size_t appendPoints(std::string & out, CoordinateView const & points,
+        Layout const & layout)
+    {
+        if (layout.point_encoding.mode == PointEncoding::Absolute) {
+            forEachTranslatedPoint(points, layout, [&](double x, double y) {
+                appendNumber(out, x, layout.number_format);
+                out += ',';
+                appendNumber(out, y, layout.number_format);
+                out += ' ';
+            });
+            return points.count;
+        }
+
+        CompactEncoder encoder(out, layout.point_encoding.quantum);
+        bool first = true;
+        long long previous_x = 0, previous_y = 0;
+        std::size_t written = 0;
+        forEachTranslatedPoint(points, layout, [&](double x, double y) {
+            long long snapped_x = encoder.snap(x);
+            long long snapped_y = encoder.snap(y);
+            if (!first && snapped_x == previous_x && snapped_y == previous_y)
+                return;
+            encoder.number(snapped_x);
+            encoder.number(snapped_y);
+            previous_x = snapped_x;
+            previous_y = snapped_y;
+            first = false;
+            ++written;
+        });
+        return written;
+    }
+
+    // Appends one closed subpath of path data.  Returns the number of points
+    //  written.
+    inline std::size_t appendSubpath(std::string & out, CoordinateView const & points,
+        Layout const & layout)
+    {
+        if (layout.point_encoding.mode == PointEncoding::Absolute) {
+            out += 'M';
+            appendPoints(out, points, layout);
+            out += "z ";
+            return points.count;
+        }
+
+        CompactEncoder encoder(out, layout.point_encoding.quantum);
+        std::size_t written = 0;
+        bool first = true;
+        char previous_command = 0;
+        long long previous_x = 0, previous_y = 0;
+        forEachTranslatedPoint(points, layout, [&](double x, double y) {
+            long long snapped_x = encoder.snap(x);
+            long long snapped_y = encoder.snap(y);
+            if (first) {
+                encoder.command('M');
+                encoder.number(snapped_x);
+                encoder.number(snapped_y);
+                first = false;
+            }
+            else {
+                long long dx = snapped_x - previous_x;
+                long long dy = snapped_y - previous_y;
+                if (dx == 0 && dy == 0)
+                    return;
+                // Repeated commands may be left out.
+                char command = dy == 0 ? 'h' : dx == 0 ? 'v' : 'l';
+                if (command != previous_command)
+                    encoder.command(command);
+                previous_command = command;
+                if (dx != 0)
+                    encoder.number(dx);
+                if (dy != 0)
+                    encoder.number(dy);
+            }
+            previous_x = snapped_x;
+            previous_y = snapped_y;
+            ++written;
+        });
+        encoder.command('z');
+        return written;
+    }
+
+    // Appends raw as a CSS string: in double quotes, with quotes, backslashes
+    //  and control characters escaped.  The result still needs XML escaping.
+    inline void appendCssString(std::string & out, std::string const & raw)
+    {
+        out += '"';
+        for (std::size_t i = 0; i < raw.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(raw[i]);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += raw[i];
+            }
+            else if (c < 0x20 || c == 0x7f) {
+                char escape[8];
+                std::snprintf(escape, sizeof escape, "\\%x ", c);
+                out += escape;
+            }
+            else
+                out += raw[i];
+        }
+        out += '"';
+    }
+    // First delimiter in [text, end) outside of CSS strings, or end.
+    inline char const * findCssDelimiter(char const * text, char const * end, char delimiter)
+    {
+        char quote = 0;
+        for (; text < end; ++text) {
+            if (quote) {
+                if (*text == '\\' && text + 1 < end)
+                    ++text;
+                else if (*text == quote)
+                    quote = 0;
+            }
+            else if (*text == '"' || *text == '\'')
+                quote = *text;
+            else if (*text == delimiter)
+                return text;
+        }
+        return end;
+    }
+    // Appends the CSS value in [text, end), with the quotes and escapes of a
+    //  CSS string removed.
+    inline void appendCssValue(std::string & out, char const * text, char const * end)
+    {
+        if (text == end || (*text != '"' && *text != '\'')) {
+            out.append(text, end);
+            return;
+        }
+        char const quote = *text++;
+        while (text < end && *text != quote) {
+            if (*text != '\\' || text + 1 == end) {
+                out += *text++;
+                continue;
+            }
+            ++text;
+            if (!std::isxdigit(static_cast<unsigned char>(*text))) {
+                out += *text++;
+                continue;
+            }
+            unsigned long code = 0;
+            for (int digits = 0; digits < 6 && text < end
+                && std::isxdigit(static_cast<unsigned char>(*text)); ++digits, ++text)
+                code = code * 16 + (std::isdigit(static_cast<unsigned char>(*text))
+                    ? *text - '0' : (*text | 0x20) - 'a' + 10);
+            if (text < end && *text == ' ')
+                ++text;
+            char entity[16];
+            std::snprintf(entity, sizeof entity, "&#%lu;", code);
+            appendUnescaped(out, entity, std::strlen(entity));
+        }
+    }
+
+    // Interns the presentation attributes of shapes as CSS classes.  Each
+    //  distinct attribute text gets the class "sN", where N counts up from
+    //  first_class (0 unless the classes are added to an existing document)
+    //  in order of first use.  Safe to share between threads.
+    class StyleSheet
+    {
+    public:
+        explicit StyleSheet(std::size_t first_class = 0) : first_class(first_class) { }
+        StyleSheet(StyleSheet const & other)
+        {
+            std::lock_guard<std::mutex> lock(other.mutex);
+            first_class = other.first_class;
+            ids = other.ids;
+            rules = other.rules;
+        }
+        // attributes is the text the shape would have written otherwise,
+        //  e.g. fill="none" stroke-width="1" stroke="rgb(255,0,0)" .
+        std::size_t intern(std::string const & attributes)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unordered_map<std::string, std::size_t>::const_iterator found = ids.find(attributes);
+            if (found != ids.end())
+                return found->second;
+
+            std::size_t id = first_class + rules.size();
+            ids.insert(std::make_pair(attributes, id));
+            rules.push_back(toCss(attributes));
+            return id;
+        }
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return rules.size();
+        }
+        // Forgets all classes; numbering starts over at first_class.
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ids.clear();
+            rules.clear();
+        }
+        // Appends a <style> element with all classes, or nothing if empty.
+        void serialize(std::string & out) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (rules.empty())
+                return;
+
+            out += "\t<style>\n";
+            for (std::size_t i = 0; i < rules.size(); ++i) {
+                out += "\t\t.s";
+                appendNumber(out, static_cast<int>(first_class + i));
+                out += '{';
+                out += rules[i];
+                out += "}\n";
+            }
+            out += "\t</style>\n";
+        }
+    private:
+        StyleSheet & operator=(StyleSheet const &);
+
+        // name="value" pairs to name:value; declarations.  CSS needs units on
+        //  lengths where attributes do not, so plain numbers get "px".  Values
+        //  with characters that mean something to CSS, like the ';' or '}' a
+        //  font family may contain, are written as CSS strings.
+        static std::string toCss(std::string const & attributes)
+        {
+            std::string css;
+            std::size_t name = 0;
+            while (name < attributes.size()) {
+                std::size_t equals = attributes.find("=\"", name);
+                if (equals == std::string::npos)
+                    break;
+                std::size_t end = attributes.find('"', equals + 2);
+                if (end == std::string::npos)
+                    break;
+                css.append(attributes, name, equals - name);
+                css += ':';
+                std::string value = attributes.substr(equals + 2, end - equals - 2);
+                if (value.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                    "0123456789 ,.-+#%()_") == std::string::npos)
+                    css += value;
+                else {
+                    // The value is escaped for an attribute, the string for
+                    //  the text of the <style> element.
+                    std::string raw, quoted;
+                    appendUnescaped(raw, value.data(), value.size());
+                    appendCssString(quoted, raw);
+                    appendEscaped(css, quoted.data(), quoted.size(), false);
+                }
+                if (!value.empty() && value.find_first_not_of("0123456789.-+e") == std::string::npos)
+                    css += "px";
+                css += ';';
+                name = end + 2;
+            }
+            return css;
+        }
+
+        std::size_t first_class;
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::size_t> ids;
+        std::vector<std::string> rules;
+    };
+
+    // Writes the presentation attributes of an element; any of the parts may be
+    //  null.  With a style sheet in the layout they become a single class.
+    inline void appendStyle(std::string & out, Layout const & layout, Fill const * fill,
+        Stroke const * stroke, double font_size, char const * font_family)
+    {
+        // Without a style sheet the attributes go straight to out.
+        static thread_local std::string attributes;
+        std::string & target = layout.style_sheet ? attributes : out;
+        if (layout.style_sheet)
+            attributes.clear();
+
+        if (fill)
+            fill->serialize(target, layout);
+        if (stroke)
+            stroke->serialize(target, layout);
+        if (font_family)
+            Font::serialize(target, layout, font_size, font_family);
+
+        if (layout.style_sheet && !attributes.empty()) {
+            out += "class=\"s";
+            appendNumber(out, static_cast<int>(layout.style_sheet->intern(attributes)));
+            out += "\" ";
+        }
+    }
+    inline void appendStyle(std::string & out, Layout const & layout, Fill const * fill,
+        Stroke const * stroke, Font const * font = 0)
+    {
+        if (font)
+            appendStyle(out, layout, fill, stroke, font->getSize(), font->getFamily().c_str());
+        else
+            appendStyle(out, layout, fill, stroke, 0, 0);
+    }
+
+    // Element writers shared by the shape classes and RetainedDocument, which
+    //  keeps shape data outside of shape objects.  Those that write point
+    //  lists return the number of points written.
+    inline std::size_t appendPointsElement(std::string & out, Layout const & layout,
+        char const * element, CoordinateView const & points, Fill const & fill,
+        Stroke const & stroke)
+    {
+        appendElemStart(out, element);
+
+        out += "points=\"";
+        std::size_t written = appendPoints(out, points, layout);
+        out += "\" ";
+
+        appendStyle(out, layout, &fill, &stroke);
+        appendEmptyElemEnd(out);
+        return written;
+    }
+    // Path data goes between appendPathStart() and appendPathEnd(), one
+    //  appendSubpath() per subpath.
+    inline void appendPathStart(std::string & out)
+    {
+        appendElemStart(out, "path");
+        out += "d=\"";
+    }
+    inline void appendPathEnd(std::string & out, Layout const & layout, Fill const & fill,
+        Stroke const & stroke)
+    {
+        out += "\" ";
+        out += "fill-rule=\"evenodd\" ";
+
+        appendStyle(out, layout, &fill, &stroke);
+        appendEmptyElemEnd(out);
+    }
+    inline void appendTextElement(std::string & out, Layout const & layout, Point const & origin,
+        char const * content, std::size_t length, Fill const & fill, Stroke const & stroke,
+        double font_size, char const * font_family)
+    {
+        appendElemStart(out, "text");
+        appendAttribute(out, "x", translateX(origin.x, layout), layout.number_format);
+        appendAttribute(out, "y", translateY(origin.y, layout), layout.number_format);
+        appendStyle(out, layout, &fill, &stroke, font_size, font_family);
+        out += '>';
+        appendEscaped(out, content, length, false);
+        appendElemEnd(out, "text");
+    }
+    // How far a stroke can reach beyond the outline of a shape, in the units
+    //  of its width.  Strokes are written with the default miter joins, and
+    //  a miter may stick out up to stroke-miterlimit (4 by default) times
+    //  half the width from its vertex before it is beveled; this also covers
+    //  square caps.
+    inline double strokeReach(Stroke const & stroke)
+    {
+        double const miter_limit = 4;
+        return stroke.getWidth() > 0 ? stroke.getWidth() / 2 * miter_limit : 0;
+    }
+    // strokeReach() in user units.
+    inline double strokeMargin(Stroke const & stroke, Layout const & layout)
+    {
+        if (stroke.isNonScaling() && layout.scale > 0)
+            return strokeReach(stroke) / layout.scale;
+        return strokeReach(stroke);
+    }
+
+    // Whether a shape with the given bounds and stroke can be seen on the
+    //  canvas.  Empty bounds stand for an unknown extent and count as visible.
+    inline bool isVisible(Bounds const & bounds, Stroke const & stroke, Layout const & layout)
+    {
+        if (bounds.empty || layout.scale <= 0)
+            return true;
+        return bounds.intersects(visibleArea(layout, strokeMargin(stroke, layout)));
+    }
+
+    // Copies the selected points into storage and returns a view of them.
+    inline CoordinateView gatherPoints(CoordinateView const & points,
+        std::vector<std::size_t> const & selected, std::vector<Point> & storage)
+    {
+        storage.clear();
+        for (std::size_t i = 0; i < selected.size(); ++i)
+            storage.push_back(Point(points.x(selected[i]), points.y(selected[i])));
+        return CoordinateView(storage.data(), storage.size());
+    }
+
+    // Returns the points with their off-canvas runs collapsed if culling is
+    //  on, or the points themselves otherwise.  The result stays valid until
+    //  the next call on the same thread.
+    inline CoordinateView cullPoints(CoordinateView const & points, Layout const & layout,
+        Stroke const & stroke)
+    {
+        if (!layout.culling || layout.scale <= 0)
+            return points;
+
+        static thread_local std::vector<std::size_t> kept;
+        static thread_local std::vector<Point> kept_points;
+        kept.clear();
+        collapseOutside(points, visibleArea(layout, strokeMargin(stroke, layout)), kept);
+        return gatherPoints(points, kept, kept_points);
+    }
+
+    inline std::size_t appendPolylineElement(std::string & out, Layout const & layout,
+        CoordinateView const & points, Decimation const & decimation,
+        Fill const & fill, Stroke const & stroke)
+    {
+        CoordinateView visible = cullPoints(points, layout, stroke);
+        if (decimation.method == Decimation::None)
+            return appendPointsElement(out, layout, "polyline", visible, fill, stroke);
+
+        // Reused by every polyline serialized on this thread.
+        static thread_local std::vector<std::size_t> kept;
+        static thread_local std::vector<Point> kept_points;
+        kept.clear();
+        decimate(visible, layout, decimation, kept);
+        return appendPointsElement(out, layout, "polyline",
+            gatherPoints(visible, kept, kept_points), fill, stroke);
+    }
+
     class Shape : public Serializeable
     {
     public:
         Shape(Fill const & fill = Fill(), Stroke const & stroke = Stroke())
             : fill(fill), stroke(stroke) { }
         virtual ~Shape() { }
-        virtual std::string toString(Layout const & layout) const = 0;
         virtual void offset(Point const & offset) = 0;
+        // Returns a copy allocated with new, owned by the caller, or null for
+        //  shapes that do not support copying through a base reference.
+        virtual Shape * clone() const { return 0; }
+        // Box around the outline of the shape in user space, stroke not
+        //  included.  Empty if the extent is unknown, which keeps the shape
+        //  from being culled.
+        virtual Bounds getBounds() const { return Bounds(); }
+        Fill const & getFill() const { return fill; }
+        Stroke const & getStroke() const { return stroke; }
     protected:
         Fill fill;
         Stroke stroke;
     };
+
+    // clone() for containers that keep copies of their shapes.  Throws
+    //  std::invalid_argument for a shape without clone(), which could only be
+    //  dropped otherwise.
+    inline Shape * cloneShape(Shape const & shape)
+    {
+        Shape * copy = shape.clone();
+        if (!copy)
+            throw std::invalid_argument("svg: shape does not implement clone()");
+        return copy;
+    }
     template <typename T>
-    inline std::string vectorToString(std::vector<T> collection, Layout const & layout)
+    inline std::string vectorToString(std::vector<T> const & collection, Layout const & layout)
     {
         std::string combination_str;
         for (unsigned i = 0; i < collection.size(); ++i)
-            combination_str += collection[i].toString(layout);
+            collection[i].serialize(combination_str, layout);
 
         return combination_str;
     }
@@ -310,20 +1856,30 @@ namespace svg
         Circle(Point const & center, double diameter, Fill const & fill,
             Stroke const & stroke = Stroke())
             : Shape(fill, stroke), center(center), radius(diameter / 2) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("circle") << attribute("cx", translateX(center.x, layout))
-                << attribute("cy", translateY(center.y, layout))
-                << attribute("r", translateScale(radius, layout)) << fill.toString(layout)
-                << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            StatsScope scope(layout, "circle", out);
+            appendElemStart(out, "circle");
+            appendAttribute(out, "cx", translateX(center.x, layout), layout.number_format);
+            appendAttribute(out, "cy", translateY(center.y, layout), layout.number_format);
+            appendAttribute(out, "r", translateScale(radius, layout), layout.number_format);
+            appendStyle(out, layout, &fill, &stroke);
+            appendEmptyElemEnd(out);
         }
         void offset(Point const & offset)
         {
             center.x += offset.x;
             center.y += offset.y;
         }
+        Shape * clone() const
+        {
+            return new Circle(*this);
+        }
+        Bounds getBounds() const
+        {
+            return Bounds(Point(center.x - radius, center.y - radius),
+                Point(center.x + radius, center.y + radius));
+        }
     private:
         Point center;
         double radius;
@@ -336,21 +1892,31 @@ namespace svg
             Fill const & fill = Fill(), Stroke const & stroke = Stroke())
             : Shape(fill, stroke), center(center), radius_width(width / 2),
             radius_height(height / 2) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("ellipse") << attribute("cx", translateX(center.x, layout))
-                << attribute("cy", translateY(center.y, layout))
-                << attribute("rx", translateScale(radius_width, layout))
-                << attribute("ry", translateScale(radius_height, layout))
-                << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            StatsScope scope(layout, "ellipse", out);
+            appendElemStart(out, "ellipse");
+            appendAttribute(out, "cx", translateX(center.x, layout), layout.number_format);
+            appendAttribute(out, "cy", translateY(center.y, layout), layout.number_format);
+            appendAttribute(out, "rx", translateScale(radius_width, layout), layout.number_format);
+            appendAttribute(out, "ry", translateScale(radius_height, layout), layout.number_format);
+            appendStyle(out, layout, &fill, &stroke);
+            appendEmptyElemEnd(out);
         }
         void offset(Point const & offset)
         {
             center.x += offset.x;
             center.y += offset.y;
         }
+        Shape * clone() const
+        {
+            return new Elipse(*this);
+        }
+        Bounds getBounds() const
+        {
+            return Bounds(Point(center.x - radius_width, center.y - radius_height),
+                Point(center.x + radius_width, center.y + radius_height));
+        }
     private:
         Point center;
         double radius_width;
@@ -364,21 +1930,34 @@ namespace svg
             Fill const & fill = Fill(), Stroke const & stroke = Stroke())
             : Shape(fill, stroke), edge(edge), width(width),
             height(height) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("rect") << attribute("x", translateX(edge.x, layout))
-                << attribute("y", translateY(edge.y, layout))
-                << attribute("width", translateScale(width, layout))
-                << attribute("height", translateScale(height, layout))
-                << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            StatsScope scope(layout, "rect", out);
+            appendElemStart(out, "rect");
+            appendAttribute(out, "x", translateX(edge.x, layout), layout.number_format);
+            appendAttribute(out, "y", translateY(edge.y, layout), layout.number_format);
+            appendAttribute(out, "width", translateScale(width, layout), layout.number_format);
+            appendAttribute(out, "height", translateScale(height, layout), layout.number_format);
+            appendStyle(out, layout, &fill, &stroke);
+            appendEmptyElemEnd(out);
         }
         void offset(Point const & offset)
         {
             edge.x += offset.x;
             edge.y += offset.y;
         }
+        Shape * clone() const
+        {
+            return new Rectangle(*this);
+        }
+        // The rectangle extends from edge along the canvas axes, so which
+        //  side of edge it covers depends on the origin of the layout.  The
+        //  box covers both sides.
+        Bounds getBounds() const
+        {
+            return Bounds(Point(edge.x - width, edge.y - height),
+                Point(edge.x + width, edge.y + height));
+        }
     private:
         Point edge;
         double width;
@@ -392,15 +1971,16 @@ namespace svg
             Stroke const & stroke = Stroke())
             : Shape(Fill(), stroke), start_point(start_point),
             end_point(end_point) { }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("line") << attribute("x1", translateX(start_point.x, layout))
-                << attribute("y1", translateY(start_point.y, layout))
-                << attribute("x2", translateX(end_point.x, layout))
-                << attribute("y2", translateY(end_point.y, layout))
-                << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            StatsScope scope(layout, "line", out);
+            appendElemStart(out, "line");
+            appendAttribute(out, "x1", translateX(start_point.x, layout), layout.number_format);
+            appendAttribute(out, "y1", translateY(start_point.y, layout), layout.number_format);
+            appendAttribute(out, "x2", translateX(end_point.x, layout), layout.number_format);
+            appendAttribute(out, "y2", translateY(end_point.y, layout), layout.number_format);
+            appendStyle(out, layout, 0, &stroke);
+            appendEmptyElemEnd(out);
         }
         void offset(Point const & offset)
         {
@@ -410,6 +1990,16 @@ namespace svg
             end_point.x += offset.x;
             end_point.y += offset.y;
         }
+        Shape * clone() const
+        {
+            return new Line(*this);
+        }
+        Bounds getBounds() const
+        {
+            Bounds bounds(start_point, start_point);
+            bounds.extend(end_point);
+            return bounds;
+        }
     private:
         Point start_point;
         Point end_point;
@@ -421,23 +2011,22 @@ namespace svg
         Polygon(Fill const & fill = Fill(), Stroke const & stroke = Stroke())
             : Shape(fill, stroke) { }
         Polygon(Stroke const & stroke = Stroke()) : Shape(Color::Transparent, stroke) { }
+        Polygon(std::vector<Point> const & points,
+            Fill const & fill = Fill(), Stroke const & stroke = Stroke())
+            : Shape(fill, stroke), points(points) { }
+        Polygon(std::vector<Point> && points,
+            Fill const & fill = Fill(), Stroke const & stroke = Stroke())
+            : Shape(fill, stroke), points(std::move(points)) { }
         Polygon & operator<<(Point const & point)
         {
             points.push_back(point);
             return *this;
         }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("polygon");
-
-            ss << "points=\"";
-            for (unsigned i = 0; i < points.size(); ++i)
-                ss << translateX(points[i].x, layout) << "," << translateY(points[i].y, layout) << " ";
-            ss << "\" ";
-
-            ss << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            StatsScope scope(layout, "polygon", out);
+            scope.setPoints(appendPointsElement(out, layout, "polygon",
+                CoordinateView(points.data(), points.size()), fill, stroke));
         }
         void offset(Point const & offset)
         {
@@ -446,6 +2035,21 @@ namespace svg
                 points[i].y += offset.y;
             }
         }
+        Shape * clone() const
+        {
+            return new Polygon(*this);
+        }
+        Bounds getBounds() const
+        {
+            Bounds bounds;
+            for (unsigned i = 0; i < points.size(); ++i)
+                bounds.extend(points[i]);
+            return bounds;
+        }
+        std::vector<Point> const & getPoints() const
+        {
+            return points;
+        }
     private:
         std::vector<Point> points;
     };
@@ -454,9 +2058,9 @@ namespace svg
     {
     public:
        Path(Fill const & fill = Fill(), Stroke const & stroke = Stroke())
-          : Shape(fill, stroke) 
+          : Shape(fill, stroke)
        {  startNewSubPath(); }
-       Path(Stroke const & stroke = Stroke()) : Shape(Color::Transparent, stroke) 
+       Path(Stroke const & stroke = Stroke()) : Shape(Color::Transparent, stroke)
        {  startNewSubPath(); }
        Path & operator<<(Point const & point)
        {
@@ -464,33 +2068,35 @@ namespace svg
           return *this;
        }
 
+       std::size_t pointCount() const
+       {
+          std::size_t count = 0;
+          for (auto const& subpath : paths)
+             count += subpath.size();
+          return count;
+       }
+
        void startNewSubPath()
        {
           if (paths.empty() || 0 < paths.back().size())
             paths.emplace_back();
        }
 
-       std::string toString(Layout const & layout) const
+       void serialize(std::string & out, Layout const & layout) const
        {
-          std::stringstream ss;
-          ss << elemStart("path");
-
-          ss << "d=\"";
+          StatsScope scope(layout, "path", out);
+          std::size_t written = 0;
+          appendPathStart(out);
           for (auto const& subpath: paths)
           {
              if (subpath.empty())
                 continue;
 
-             ss << "M";
-             for (auto const& point: subpath)
-                ss << translateX(point.x, layout) << "," << translateY(point.y, layout) << " ";
-             ss << "z ";
+             written += appendSubpath(out, cullPoints(CoordinateView(subpath.data(),
+                subpath.size()), layout, stroke), layout);
           }
-          ss << "\" ";
-          ss << "fill-rule=\"evenodd\" ";
-
-          ss << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-          return ss.str();
+          appendPathEnd(out, layout, fill, stroke);
+          scope.setPoints(written);
        }
 
        void offset(Point const & offset)
@@ -502,6 +2108,22 @@ namespace svg
                 point.y += offset.y;
              }
        }
+       Shape * clone() const
+       {
+          return new Path(*this);
+       }
+       Bounds getBounds() const
+       {
+          Bounds bounds;
+          for (auto const& subpath : paths)
+             for (auto const& point : subpath)
+                bounds.extend(point);
+          return bounds;
+       }
+       std::vector<std::vector<Point>> const & getSubpaths() const
+       {
+          return paths;
+       }
     private:
        std::vector<std::vector<Point>> paths;
     };
@@ -511,27 +2133,39 @@ namespace svg
     public:
         Polyline(Fill const & fill = Fill(), Stroke const & stroke = Stroke())
             : Shape(fill, stroke) { }
-        Polyline(Stroke const & stroke = Stroke()) : Shape(Color::Transparent, stroke) { }
+        Polyline(Stroke const & stroke = Stroke())
+            : Shape(Color::Transparent, stroke) { }
         Polyline(std::vector<Point> const & points,
             Fill const & fill = Fill(), Stroke const & stroke = Stroke())
             : Shape(fill, stroke), points(points) { }
+        Polyline(std::vector<Point> && points,
+            Fill const & fill = Fill(), Stroke const & stroke = Stroke())
+            : Shape(fill, stroke), points(std::move(points)) { }
+        // Off by default.  Decimation assumes points ordered along x.
+        void setDecimation(Decimation const & decimation)
+        {
+            this->decimation = decimation;
+        }
         Polyline & operator<<(Point const & point)
         {
             points.push_back(point);
             return *this;
         }
-        std::string toString(Layout const & layout) const
+        // Bounding box of the points.  It is computed on every call rather
+        //  than cached, since `points` may be edited in place; a single pass
+        //  costs no more than serializing them.
+        Bounds getBounds() const
         {
-            std::stringstream ss;
-            ss << elemStart("polyline");
-
-            ss << "points=\"";
-            for (unsigned i = 0; i < points.size(); ++i)
-                ss << translateX(points[i].x, layout) << "," << translateY(points[i].y, layout) << " ";
-            ss << "\" ";
-
-            ss << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            Bounds bounds;
+            for (std::size_t i = 0; i < points.size(); ++i)
+                bounds.extend(points[i]);
+            return bounds;
+        }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            StatsScope scope(layout, "polyline", out);
+            scope.setPoints(appendPolylineElement(out, layout,
+                CoordinateView(points.data(), points.size()), decimation, fill, stroke));
         }
         void offset(Point const & offset)
         {
@@ -540,170 +2174,4207 @@ namespace svg
                 points[i].y += offset.y;
             }
         }
-        std::vector<Point> points;
-    };
-
-    class Text : public Shape
-    {
-    public:
-        Text(Point const & origin, std::string const & content, Fill const & fill = Fill(),
-             Font const & font = Font(), Stroke const & stroke = Stroke())
-            : Shape(fill, stroke), origin(origin), content(content), font(font) { }
-        std::string toString(Layout const & layout) const
+        Shape * clone() const
         {
-            std::stringstream ss;
-            ss << elemStart("text") << attribute("x", translateX(origin.x, layout))
-                << attribute("y", translateY(origin.y, layout))
-                << fill.toString(layout) << stroke.toString(layout) << font.toString(layout)
-                << ">" << content << elemEnd("text");
-            return ss.str();
+            return new Polyline(*this);
         }
-        void offset(Point const & offset)
+        Decimation const & getDecimation() const
         {
-            origin.x += offset.x;
-            origin.y += offset.y;
+            return decimation;
         }
+        std::vector<Point> points;
     private:
-        Point origin;
-        std::string content;
-        Font font;
+        Decimation decimation;
     };
 
-    // Sample charting class.
-    class LineChart : public Shape
+    // Polyline over coordinates owned by the caller, such as the columns of a
+    //  large data set, written without copying them into Points.  Any layout
+    //  CoordinateView describes works: Point arrays, separate x and y arrays
+    //  and strided buffers.  The coordinates must outlive the view and its
+    //  clones.
+    class PolylineView : public Shape
     {
     public:
-        LineChart(Dimensions margin = Dimensions(), double scale = 1,
-                  Stroke const & axis_stroke = Stroke(.5, Color::Purple))
-            : axis_stroke(axis_stroke), margin(margin), scale(scale) { }
-        LineChart & operator<<(Polyline const & polyline)
+        PolylineView(CoordinateView const & points, Fill const & fill = Fill(),
+            Stroke const & stroke = Stroke())
+            : Shape(fill, stroke), points(points), shift(0, 0) { }
+        // Off by default.  Decimation assumes points ordered along x.
+        void setDecimation(Decimation const & decimation)
         {
-            if (polyline.points.empty())
-                return *this;
-
-            polylines.push_back(polyline);
-            return *this;
+            this->decimation = decimation;
         }
-        std::string toString(Layout const & layout) const
+        void serialize(std::string & out, Layout const & layout) const
         {
-            if (polylines.empty())
-                return "";
-
-            std::string ret;
-            for (unsigned i = 0; i < polylines.size(); ++i)
-                ret += polylineToString(polylines[i], layout);
-
-            return ret + axisString(layout);
+            StatsScope scope(layout, "polyline", out);
+            scope.setPoints(appendPolylineElement(out, shiftedLayout(layout, shift), points,
+                decimation, fill, stroke));
         }
+        // The coordinates are left alone; the offset is applied when writing.
         void offset(Point const & offset)
         {
-            for (unsigned i = 0; i < polylines.size(); ++i)
-                polylines[i].offset(offset);
-        }
-    private:
-        Stroke axis_stroke;
-        Dimensions margin;
-        double scale;
-        std::vector<Polyline> polylines;
-
-        optional<Dimensions> getDimensions() const
-        {
-            if (polylines.empty())
-                return optional<Dimensions>();
-
-            optional<Point> min = getMinPoint(polylines[0].points);
-            optional<Point> max = getMaxPoint(polylines[0].points);
-            for (unsigned i = 0; i < polylines.size(); ++i) {
-                if (getMinPoint(polylines[i].points)->x < min->x)
-                    min->x = getMinPoint(polylines[i].points)->x;
-                if (getMinPoint(polylines[i].points)->y < min->y)
-                    min->y = getMinPoint(polylines[i].points)->y;
-                if (getMaxPoint(polylines[i].points)->x > max->x)
-                    max->x = getMaxPoint(polylines[i].points)->x;
-                if (getMaxPoint(polylines[i].points)->y > max->y)
-                    max->y = getMaxPoint(polylines[i].points)->y;
-            }
-
-            return optional<Dimensions>(Dimensions(max->x - min->x, max->y - min->y));
+            shift.x += offset.x;
+            shift.y += offset.y;
         }
-        std::string axisString(Layout const & layout) const
+        Shape * clone() const
         {
-            optional<Dimensions> dimensions = getDimensions();
-            if (!dimensions)
-                return "";
-
-            // Make the axis 10% wider and higher than the data points.
-            double width = dimensions->width * 1.1;
-            double height = dimensions->height * 1.1;
-
-            // Draw the axis.
-            Polyline axis(Color::Transparent, axis_stroke);
-            axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
-                << Point(margin.width + width, margin.height);
-
-            return axis.toString(layout);
+            return new PolylineView(*this);
         }
-        std::string polylineToString(Polyline const & polyline, Layout const & layout) const
+        Bounds getBounds() const
         {
-            Polyline shifted_polyline = polyline;
-            shifted_polyline.offset(Point(margin.width, margin.height));
-
-            std::vector<Circle> vertices;
-            for (unsigned i = 0; i < shifted_polyline.points.size(); ++i)
-                vertices.push_back(Circle(shifted_polyline.points[i], getDimensions()->height / 30.0, Color::Black));
-
-            return shifted_polyline.toString(layout) + vectorToString(vertices, layout);
+            Bounds bounds = boundsOf(points);
+            bounds.offset(shift);
+            return bounds;
         }
+    private:
+        CoordinateView points;
+        Decimation decimation;
+        Point shift;
     };
 
-    class Document
+    // Polygon counterpart of PolylineView.
+    class PolygonView : public Shape
     {
     public:
-        Document(std::string const & file_name, Layout layout = Layout())
-            : file_name(file_name), layout(layout) { }
-
-        Document & operator<<(Shape const & shape)
+        PolygonView(CoordinateView const & points, Fill const & fill = Fill(),
+            Stroke const & stroke = Stroke())
+            : Shape(fill, stroke), points(points), shift(0, 0) { }
+        void serialize(std::string & out, Layout const & layout) const
         {
-            body_nodes_str_list.push_back(shape.toString(layout));
-            return *this;
+            StatsScope scope(layout, "polygon", out);
+            scope.setPoints(appendPointsElement(out, shiftedLayout(layout, shift), "polygon",
+                points, fill, stroke));
         }
-        std::string toString() const
+        void offset(Point const & offset)
         {
-            std::stringstream ss;
-            writeToStream(ss);
-            return ss.str();
+            shift.x += offset.x;
+            shift.y += offset.y;
         }
-        bool save() const
+        Shape * clone() const
         {
-            std::ofstream ofs(file_name.c_str());
-            if (!ofs.good())
-                return false;
-
-            writeToStream(ofs);
-            ofs.close();
-            return true;
+            return new PolygonView(*this);
         }
-    private:
-        void writeToStream(std::ostream& str) const
+        Bounds getBounds() const
         {
-            str << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
-                << "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
-                << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg "
-                << attribute("width", layout.dimensions.width, "px")
-                << attribute("height", layout.dimensions.height, "px")
-                << attribute("xmlns", "http://www.w3.org/2000/svg")
-                << attribute("version", "1.1") << ">\n";
-            for (const auto& body_node_str : body_nodes_str_list) {
-                str << body_node_str;
-            }
-            str << elemEnd("svg");
+            Bounds bounds = boundsOf(points);
+            bounds.offset(shift);
+            return bounds;
         }
-
     private:
-        std::string file_name;
+        CoordinateView points;
+        Point shift;
+    };
+
+    class Text : public Shape
+    {
+    public:
+        Text(Point const & origin, std::string const & content, Fill const & fill = Fill(),
+             Font const & font = Font(), Stroke const & stroke = Stroke())
+            : Shape(fill, stroke), origin(origin), content(content), font(font) { }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            StatsScope scope(layout, "text", out);
+            appendTextElement(out, layout, origin, content.data(), content.size(), fill, stroke,
+                font.getSize(), font.getFamily().c_str());
+        }
+        void offset(Point const & offset)
+        {
+            origin.x += offset.x;
+            origin.y += offset.y;
+        }
+        Shape * clone() const
+        {
+            return new Text(*this);
+        }
+        // A box the glyphs do not leave: up to the font size around the
+        //  baseline, and a font size per byte of content either side of the
+        //  origin, since the direction the text runs in depends on the layout.
+        Bounds getBounds() const
+        {
+            double size = std::fabs(font.getSize());
+            double width = size * content.size();
+            return Bounds(Point(origin.x - width, origin.y - size),
+                Point(origin.x + width, origin.y + size));
+        }
+        Point const & getOrigin() const { return origin; }
+        std::string const & getContent() const { return content; }
+        Font const & getFont() const { return font; }
+    private:
+        Point origin;
+        std::string content;
+        Font font;
+    };
+
+    // Layout in which definitions are serialized: same scale and formatting as
+    //  layout, but with (0, 0) at the origin of the referencing <use> and y
+    //  pointing down, so a definition centred on (0, 0) is placed by its
+    //  reference point.  Definitions sit outside of any Group, so the scale
+    //  of the enclosing groups is folded into the scale.
+    inline Layout definitionLayout(Layout const & layout)
+    {
+        Layout local = layout;
+        local.origin = Layout::TopLeft;
+        local.origin_offset = Point(0, 0);
+        local.scale *= layout.group_scale;
+        local.point_encoding.quantum *= layout.group_scale;
+        local.group_scale = 1;
+        return local;
+    }
+    // Appends shape as a reusable element with the given id, to be placed
+    //  within a <defs> element.
+    inline void appendDefinition(std::string & out, std::string const & id, Shape const & shape,
+        Layout const & layout)
+    {
+        out += "\t<g ";
+        appendAttribute(out, "id", id);
+        out += ">\n";
+        shape.serialize(out, definitionLayout(layout));
+        out += "\t</g>\n";
+    }
+    // Inside a Group, the definition is scaled back by the scale of the
+    //  groups, since it was serialized at the full scale already.
+    inline void appendUse(std::string & out, std::string const & id, Point const & position,
+        Layout const & layout)
+    {
+        appendElemStart(out, "use");
+        out += "xlink:href=\"#";
+        appendEscaped(out, id.data(), id.size(), true);
+        out += "\" ";
+        double x = translateX(position.x, layout);
+        double y = translateY(position.y, layout);
+        if (layout.group_scale == 1 || !(layout.group_scale > 0)) {
+            appendAttribute(out, "x", x, layout.number_format);
+            appendAttribute(out, "y", y, layout.number_format);
+        }
+        else {
+            out += "transform=\"translate(";
+            appendNumber(out, x, layout.number_format);
+            out += ' ';
+            appendNumber(out, y, layout.number_format);
+            out += ") scale(";
+            appendNumber(out, 1 / layout.group_scale, NumberFormat::shortest());
+            out += ")\" ";
+        }
+        appendEmptyElemEnd(out);
+    }
+
+    // Definitions registered by shapes while they are serialized, such as the
+    //  vertex marker of a LineChart.  Each id is defined by its first
+    //  registration only, however often the shape is serialized.  Documents
+    //  point layout.symbols at their table and write it after the body;
+    //  <use> may reference a definition further down.
+    class SymbolTable
+    {
+    public:
+        SymbolTable() { }
+        SymbolTable(SymbolTable const & other)
+        {
+            std::lock_guard<std::mutex> lock(other.mutex);
+            ids = other.ids;
+            ends = other.ends;
+            definitions = other.definitions;
+        }
+        // Adds shape under id unless id is defined already.  Returns whether
+        //  it was added.
+        bool define(std::string const & id, Shape const & shape, Layout const & layout)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ids.insert(id).second)
+                return false;
+            appendDefinition(definitions, id, shape, layout);
+            ends.push_back(std::make_pair(id, definitions.size()));
+            return true;
+        }
+        // Adds the definitions of other whose ids are not defined already, in
+        //  the order other defined them.
+        void merge(SymbolTable const & other)
+        {
+            std::lock(mutex, other.mutex);
+            std::lock_guard<std::mutex> lock(mutex, std::adopt_lock);
+            std::lock_guard<std::mutex> other_lock(other.mutex, std::adopt_lock);
+            std::size_t begin = 0;
+            for (std::size_t i = 0; i < other.ends.size(); ++i) {
+                std::size_t end = other.ends[i].second;
+                if (ids.insert(other.ends[i].first).second) {
+                    definitions.append(other.definitions, begin, end - begin);
+                    ends.push_back(std::make_pair(other.ends[i].first, definitions.size()));
+                }
+                begin = end;
+            }
+        }
+        bool empty() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return ends.empty();
+        }
+        // Appends a <defs> element with all definitions, or nothing if empty.
+        void serialize(std::string & out) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (definitions.empty())
+                return;
+            out += "\t<defs>\n";
+            out += definitions;
+            out += "\t</defs>\n";
+        }
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ids.clear();
+            ends.clear();
+            definitions.clear();
+        }
+    private:
+        SymbolTable & operator=(SymbolTable const &);
+
+        mutable std::mutex mutex;
+        std::unordered_set<std::string> ids;
+        // Each id in order of definition, with the end of its definition.
+        std::vector<std::pair<std::string, std::size_t> > ends;
+        std::string definitions;
+    };
+
+    // Places a copy of a definition, see Document::define().  A <use> costs a
+    //  few bytes regardless of how large the referenced shape is.  Its bounds
+    //  are unknown, since the definition is not at hand; TileExporter takes
+    //  them from its own definitions.
+    class Use : public Shape
+    {
+    public:
+        Use(std::string const & id, Point const & position)
+            : id(id), position(position) { }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            StatsScope scope(layout, "use", out);
+            appendUse(out, id, position, layout);
+        }
+        void offset(Point const & offset)
+        {
+            position.x += offset.x;
+            position.y += offset.y;
+        }
+        Shape * clone() const
+        {
+            return new Use(*this);
+        }
+        std::string const & getId() const { return id; }
+        Point const & getPosition() const { return position; }
+    private:
+        std::string id;
+        Point position;
+    };
+
+    // Shapes drawn in their own coordinates.  The scale and offset of the
+    //  layout are applied once, by the viewer, through the transform of a <g>
+    //  element instead of to every coordinate.  Children are written at scale
+    //  1, so the number format must have enough digits for user coordinates.
+    //  The transform only translates and scales; an origin that flips an
+    //  axis flips the coordinates of the children, which keeps rectangles
+    //  and text the same way round as outside a group.  Non-scaling strokes
+    //  and Use keep the sizes they have outside a group.
+    class Group : public Shape
+    {
+    public:
+        Group() { }
+        Group(Group const & other) : Shape(other)
+        {
+            copyChildren(other);
+        }
+        Group & operator=(Group const & other)
+        {
+            if (this != &other) {
+                Shape::operator=(other);
+                children.clear();
+                copyChildren(other);
+            }
+            return *this;
+        }
+        // Adds a copy of shape, see cloneShape().
+        Group & operator<<(Shape const & shape)
+        {
+            children.push_back(std::unique_ptr<Shape>(cloneShape(shape)));
+            return *this;
+        }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            StatsScope scope(layout, "g", out);
+            bool flip_x = layout.origin == Layout::BottomRight || layout.origin == Layout::TopRight;
+            bool flip_y = layout.origin == Layout::BottomLeft || layout.origin == Layout::BottomRight;
+            double offset_x = layout.origin_offset.x * layout.scale;
+            double offset_y = layout.origin_offset.y * layout.scale;
+
+            out += "\t<g transform=\"matrix(";
+            appendNumber(out, layout.scale, NumberFormat::shortest());
+            out += " 0 0 ";
+            appendNumber(out, layout.scale, NumberFormat::shortest());
+            out += ' ';
+            appendNumber(out, flip_x ? layout.dimensions.width - offset_x : offset_x,
+                NumberFormat::shortest());
+            out += ' ';
+            appendNumber(out, flip_y ? layout.dimensions.height - offset_y : offset_y,
+                NumberFormat::shortest());
+            out += ")\">\n";
+
+            // Keeps the origin, so that a flipped axis maps c to -c.
+            Layout local = layout;
+            local.dimensions = Dimensions(0, 0);
+            local.scale = 1;
+            local.origin_offset = Point(0, 0);
+            local.culling = false;
+            local.group_scale = layout.group_scale * layout.scale;
+            if (layout.scale > 0)
+                local.point_encoding.quantum /= layout.scale;
+            for (std::size_t i = 0; i < children.size(); ++i)
+                children[i]->serialize(out, local);
+            out += "\t</g>\n";
+        }
+        void offset(Point const & offset)
+        {
+            for (std::size_t i = 0; i < children.size(); ++i)
+                children[i]->offset(offset);
+        }
+        Shape * clone() const
+        {
+            return new Group(*this);
+        }
+        // Empty if any child has unknown bounds.
+        Bounds getBounds() const
+        {
+            Bounds bounds;
+            for (std::size_t i = 0; i < children.size(); ++i) {
+                Bounds child = children[i]->getBounds();
+                if (child.empty)
+                    return Bounds();
+                bounds.extend(child);
+            }
+            return bounds;
+        }
+        std::size_t size() const
+        {
+            return children.size();
+        }
+    private:
+        void copyChildren(Group const & other)
+        {
+            for (std::size_t i = 0; i < other.children.size(); ++i)
+                children.push_back(std::unique_ptr<Shape>(other.children[i]->clone()));
+        }
+
+        std::vector<std::unique_ptr<Shape> > children;
+    };
+
+    // Position of T in Ts.  Fails to compile if T is not one of Ts.
+    template <typename T, typename... Ts>
+    struct TypeIndex;
+    template <typename T, typename... Rest>
+    struct TypeIndex<T, T, Rest...>
+    {
+        static std::size_t const value = 0;
+    };
+    template <typename T, typename U, typename... Rest>
+    struct TypeIndex<T, U, Rest...>
+    {
+        static std::size_t const value = 1 + TypeIndex<T, Rest...>::value;
+    };
+
+    // Shapes of the types Ts in one contiguous vector per type, for large
+    //  numbers of small shapes.  Document order is kept as runs of shapes of
+    //  the same type, and each run is serialized in a loop over its vector
+    //  with static dispatch, so shapes are neither allocated one by one nor
+    //  serialized through virtual calls.  The batch itself is a Shape, so
+    //  the whole batch is added to a document with a single call:
+    //
+    //      ShapeBatch<Circle, Rectangle> batch;
+    //      batch << Circle(...) << Rectangle(...);
+    //      doc << batch;
+    template <typename... Ts>
+    class ShapeBatch : public Shape
+    {
+        static_assert(sizeof...(Ts) > 0, "ShapeBatch needs at least one shape type");
+    public:
+        ShapeBatch() : count(0) { }
+
+        template <typename T>
+        ShapeBatch & operator<<(T const & shape)
+        {
+            std::size_t const type = TypeIndex<T, Ts...>::value;
+            std::get<TypeIndex<T, Ts...>::value>(lists).push_back(shape);
+            if (!runs.empty() && runs.back().type == type)
+                ++runs.back().count;
+            else
+                runs.push_back(Run(type));
+            ++count;
+            return *this;
+        }
+        template <typename T>
+        void reserve(std::size_t size)
+        {
+            std::get<TypeIndex<T, Ts...>::value>(lists).reserve(size);
+        }
+        std::size_t size() const
+        {
+            return count;
+        }
+        void clear()
+        {
+            Clear clear;
+            forEachList(lists, clear);
+            runs.clear();
+            count = 0;
+        }
+
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            // One writer per type; the run type picks it.
+            typedef void (ShapeBatch::*WriteRun)(std::size_t, std::size_t, std::string &,
+                Layout const &) const;
+            static WriteRun const writers[] = { &ShapeBatch::writeRun<Ts>... };
+
+            // Small shapes take about 64 bytes; growing the buffer once up
+            //  front avoids repeated reallocation and copying.
+            out.reserve(out.size() + count * 64);
+            std::size_t next[sizeof...(Ts)] = { };
+            for (std::size_t i = 0; i < runs.size(); ++i) {
+                Run const & run = runs[i];
+                (this->*writers[run.type])(next[run.type], run.count, out, layout);
+                next[run.type] += run.count;
+            }
+        }
+        void offset(Point const & offset)
+        {
+            Offset function(offset);
+            forEachList(lists, function);
+        }
+        Shape * clone() const
+        {
+            return new ShapeBatch(*this);
+        }
+        // Empty if any shape has unknown bounds.
+        Bounds getBounds() const
+        {
+            Extent function;
+            forEachList(lists, function);
+            return function.unknown ? Bounds() : function.bounds;
+        }
+    private:
+        // Serializes count shapes of type T, starting at first.  The qualified
+        //  call bypasses the vtable, so it can be inlined.
+        template <typename T>
+        void writeRun(std::size_t first, std::size_t count, std::string & out,
+            Layout const & layout) const
+        {
+            std::vector<T> const & list = std::get<TypeIndex<T, Ts...>::value>(lists);
+            for (std::size_t i = first; i < first + count; ++i)
+                list[i].T::serialize(out, layout);
+        }
+        // Calls function on the list of each type, in the order of Ts.
+        template <typename Lists, typename Function>
+        static void forEachList(Lists & lists, Function & function)
+        {
+            int expand[] = { (function(std::get<TypeIndex<Ts, Ts...>::value>(lists)), 0)... };
+            (void)expand;
+        }
+        struct Run
+        {
+            explicit Run(std::size_t type) : type(type), count(1) { }
+            std::size_t type;
+            std::size_t count;
+        };
+        struct Clear
+        {
+            template <typename T>
+            void operator()(std::vector<T> & list) { list.clear(); }
+        };
+        struct Offset
+        {
+            explicit Offset(Point const & offset) : offset(offset) { }
+            template <typename T>
+            void operator()(std::vector<T> & list)
+            {
+                for (std::size_t i = 0; i < list.size(); ++i)
+                    list[i].T::offset(offset);
+            }
+            Point offset;
+        };
+        struct Extent
+        {
+            Extent() : unknown(false) { }
+            template <typename T>
+            void operator()(std::vector<T> const & list)
+            {
+                for (std::size_t i = 0; i < list.size() && !unknown; ++i) {
+                    Bounds shape = list[i].T::getBounds();
+                    unknown = shape.empty;
+                    bounds.extend(shape);
+                }
+            }
+            Bounds bounds;
+            bool unknown;
+        };
+
+        std::tuple<std::vector<Ts>...> lists;
+        std::vector<Run> runs;
+        std::size_t count;
+    };
+
+    // Sample charting class.
+    class LineChart : public Shape
+    {
+    public:
+        LineChart(Dimensions margin = Dimensions(), double scale = 1,
+                  Stroke const & axis_stroke = Stroke(.5, Color::Purple))
+            : axis_stroke(axis_stroke), margin(margin), scale(scale) { }
+        // Reduces every series, and its vertex markers, when rendering.
+        void setDecimation(Decimation const & decimation)
+        {
+            this->decimation = decimation;
+        }
+        // Draws the vertex markers as <use> references to a single circle,
+        //  defined by the chart under the given id followed by '-' and the
+        //  diameter of the markers, so charts of different sizes do not share
+        //  one.  Documents register the definition in their SymbolTable, so
+        //  it is written once however often the chart is serialized; without
+        //  one, e.g. in toString(), it is written in front of the markers.
+        //  Ids starting with id must not be used for anything else in the
+        //  document; an empty id turns instancing off.
+        void setVertexSymbol(std::string const & id)
+        {
+            vertex_symbol = id;
+        }
+        LineChart & operator<<(Polyline const & polyline)
+        {
+            if (polyline.points.empty())
+                return *this;
+
+            polylines.push_back(polyline);
+            return *this;
+        }
+        LineChart & operator<<(Polyline && polyline)
+        {
+            if (polyline.points.empty())
+                return *this;
+
+            polylines.push_back(std::move(polyline));
+            return *this;
+        }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            StatsScope scope(layout, "linechart", out);
+            optional<Dimensions> dimensions = getDimensions();
+            if (!dimensions)
+                return;
+
+            double vertex_diameter = dimensions->height / 30.0;
+            std::string symbol;
+            if (!vertex_symbol.empty()) {
+                symbol = vertex_symbol + '-';
+                appendShortest(symbol, vertex_diameter);
+                Circle marker(Point(0, 0), vertex_diameter, Color::Black);
+                if (layout.symbols)
+                    layout.symbols->define(symbol, marker, layout);
+                else {
+                    out += "\t<defs>\n";
+                    appendDefinition(out, symbol, marker, layout);
+                    out += "\t</defs>\n";
+                }
+            }
+            for (unsigned i = 0; i < polylines.size(); ++i)
+                serializePolyline(out, polylines[i], vertex_diameter, symbol, layout);
+
+            serializeAxis(out, dimensions->width, dimensions->height, layout);
+        }
+        void offset(Point const & offset)
+        {
+            for (unsigned i = 0; i < polylines.size(); ++i)
+                polylines[i].offset(offset);
+        }
+        Shape * clone() const
+        {
+            return new LineChart(*this);
+        }
+    private:
+        Stroke axis_stroke;
+        Dimensions margin;
+        double scale;
+        Decimation decimation;
+        std::string vertex_symbol;
+        std::vector<Polyline> polylines;
+
+        optional<Dimensions> getDimensions() const
+        {
+            if (polylines.empty())
+                return optional<Dimensions>();
+
+            Bounds bounds;
+            for (unsigned i = 0; i < polylines.size(); ++i)
+                bounds.extend(polylines[i].getBounds());
+
+            return optional<Dimensions>(Dimensions(bounds.max.x - bounds.min.x,
+                bounds.max.y - bounds.min.y));
+        }
+        void serializeAxis(std::string & out, double data_width, double data_height,
+            Layout const & layout) const
+        {
+            // Make the axis 10% wider and higher than the data points.
+            double width = data_width * 1.1;
+            double height = data_height * 1.1;
+
+            // Draw the axis.
+            Polyline axis(Color::Transparent, axis_stroke);
+            axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
+                << Point(margin.width + width, margin.height);
+
+            axis.serialize(out, layout);
+        }
+        // The margin is applied through the layout, so the points are not
+        //  copied.  Markers go on the vertices the line keeps after culling
+        //  and decimation, and off-canvas ones are left out when culling.
+        void serializePolyline(std::string & out, Polyline const & polyline,
+            double vertex_diameter, std::string const & symbol, Layout const & layout) const
+        {
+            Layout shifted = shiftedLayout(layout, Point(margin.width, margin.height));
+            CoordinateView points(polyline.points.data(), polyline.points.size());
+            Decimation const & effective = decimation.method == Decimation::None
+                ? polyline.getDecimation() : decimation;
+            {
+                StatsScope scope(layout, "polyline", out);
+                scope.setPoints(appendPolylineElement(out, shifted, points, effective,
+                    polyline.getFill(), polyline.getStroke()));
+            }
+
+            CoordinateView visible = cullPoints(points, shifted, polyline.getStroke());
+            if (effective.method == Decimation::None) {
+                for (std::size_t i = 0; i < visible.count; ++i)
+                    serializeVertex(out, Point(visible.x(i), visible.y(i)), vertex_diameter,
+                        symbol, shifted);
+                return;
+            }
+
+            std::vector<std::size_t> kept;
+            decimate(visible, shifted, effective, kept);
+            for (std::size_t i = 0; i < kept.size(); ++i)
+                serializeVertex(out, Point(visible.x(kept[i]), visible.y(kept[i])),
+                    vertex_diameter, symbol, shifted);
+        }
+        void serializeVertex(std::string & out, Point const & vertex, double vertex_diameter,
+            std::string const & symbol, Layout const & layout) const
+        {
+            Circle marker(vertex, vertex_diameter, Color::Black);
+            if (layout.culling && !isVisible(marker.getBounds(), marker.getStroke(), layout))
+                return;
+            if (symbol.empty())
+                marker.serialize(out, layout);
+            else
+                appendUse(out, symbol, vertex, layout);
+        }
+    };
+
+    // Minimum (Before = std::less<double>) or maximum (std::greater<double>)
+    //  of the last `capacity` values pushed.  Values that can no longer
+    //  become the extreme are dropped as soon as a better one arrives, so
+    //  the queue is monotonic and fits in fixed storage: push() is amortized
+    //  O(1) and current() O(1).
+    template <typename Before>
+    class RollingExtreme
+    {
+    public:
+        explicit RollingExtreme(std::size_t capacity = 1)
+            : entries(capacity ? capacity : 1), first(0), count(0), pushed(0) { }
+        void push(double value)
+        {
+            std::size_t const capacity = entries.size();
+            while (count > 0 && !Before()(entries[(first + count - 1) % capacity].value, value))
+                --count;
+            if (count > 0 && entries[first].sequence + capacity <= pushed) {
+                first = (first + 1) % capacity;
+                --count;
+            }
+            Entry & entry = entries[(first + count) % capacity];
+            entry.sequence = pushed++;
+            entry.value = value;
+            ++count;
+        }
+        // The extreme of the window; only valid after a push().
+        double current() const
+        {
+            return entries[first].value;
+        }
+        void clear()
+        {
+            first = count = 0;
+            pushed = 0;
+        }
+    private:
+        struct Entry
+        {
+            Entry() : sequence(0), value(0) { }
+            unsigned long long sequence;
+            double value;
+        };
+
+        std::vector<Entry> entries;
+        std::size_t first;
+        std::size_t count;
+        unsigned long long pushed;
+    };
+
+    // The latest `capacity` samples of a series.  Each sample is stored
+    //  twice, capacity apart, so the window is always one contiguous run of
+    //  points that can be serialized in place, without copying.
+    class RollingSeries
+    {
+    public:
+        explicit RollingSeries(std::size_t capacity = 1, Stroke const & stroke = Stroke())
+            : stroke(stroke), points(2 * (capacity ? capacity : 1)), next(0), count(0),
+            min_x(capacity), min_y(capacity), max_x(capacity), max_y(capacity) { }
+        void push(Point const & sample)
+        {
+            std::size_t const capacity = points.size() / 2;
+            points[next] = sample;
+            points[next + capacity] = sample;
+            next = next + 1 == capacity ? 0 : next + 1;
+            if (count < capacity)
+                ++count;
+            min_x.push(sample.x);
+            min_y.push(sample.y);
+            max_x.push(sample.x);
+            max_y.push(sample.y);
+        }
+        void clear()
+        {
+            next = count = 0;
+            min_x.clear();
+            min_y.clear();
+            max_x.clear();
+            max_y.clear();
+        }
+        std::size_t size() const
+        {
+            return count;
+        }
+        std::size_t capacity() const
+        {
+            return points.size() / 2;
+        }
+        // The samples in the window, oldest first.
+        CoordinateView window() const
+        {
+            std::size_t const capacity = points.size() / 2;
+            std::size_t start = next >= count ? next - count : next + capacity - count;
+            return CoordinateView(points.data() + start, count);
+        }
+        // Box around the samples in the window; empty without samples.
+        Bounds getBounds() const
+        {
+            if (count == 0)
+                return Bounds();
+            return Bounds(Point(min_x.current(), min_y.current()),
+                Point(max_x.current(), max_y.current()));
+        }
+        Stroke const & getStroke() const
+        {
+            return stroke;
+        }
+    private:
+        Stroke stroke;
+        std::vector<Point> points;
+        // Where the next sample goes, in the first half of points.
+        std::size_t next;
+        std::size_t count;
+        RollingExtreme<std::less<double> > min_x;
+        RollingExtreme<std::less<double> > min_y;
+        RollingExtreme<std::greater<double> > max_x;
+        RollingExtreme<std::greater<double> > max_y;
+    };
+
+    // Line chart for live time series.  Each series keeps only its latest
+    //  samples, so memory stays the same however many are pushed, and the
+    //  axis range is kept up to date as samples enter and leave the window.
+    //  Rendering writes the current window, shifted so that its lower left
+    //  corner sits at the margin, with axes like those of LineChart.
+    class RollingLineChart : public Shape
+    {
+    public:
+        RollingLineChart(std::size_t capacity, Dimensions margin = Dimensions(),
+            Stroke const & axis_stroke = Stroke(.5, Color::Purple))
+            : capacity(capacity), axis_stroke(axis_stroke), margin(margin) { }
+        // Adds a series holding up to the chart's capacity of samples and
+        //  returns its index for push().
+        std::size_t addSeries(Stroke const & stroke = Stroke(1, Color::Blue))
+        {
+            series.push_back(RollingSeries(capacity, stroke));
+            return series.size() - 1;
+        }
+        // Appends a sample to a series, dropping its oldest sample once the
+        //  series is full.  Amortized O(1).
+        void push(std::size_t index, Point const & sample)
+        {
+            series[index].push(sample);
+        }
+        // Reduces every series when rendering, see Polyline::setDecimation().
+        void setDecimation(Decimation const & decimation)
+        {
+            this->decimation = decimation;
+        }
+        std::size_t seriesCount() const
+        {
+            return series.size();
+        }
+        RollingSeries const & getSeries(std::size_t index) const
+        {
+            return series[index];
+        }
+        // Box around the samples in all windows; O(series).
+        Bounds getRange() const
+        {
+            Bounds range;
+            for (std::size_t i = 0; i < series.size(); ++i)
+                if (series[i].size() > 0)
+                    range.extend(series[i].getBounds());
+            return range;
+        }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            StatsScope scope(layout, "rollinglinechart", out);
+            Bounds range = getRange();
+            if (range.empty)
+                return;
+
+            Layout shifted = shiftedLayout(layout, Point(shift.x + margin.width - range.min.x,
+                shift.y + margin.height - range.min.y));
+            for (std::size_t i = 0; i < series.size(); ++i) {
+                CoordinateView window = series[i].window();
+                if (window.count == 0)
+                    continue;
+                StatsScope series_scope(layout, "polyline", out);
+                series_scope.setPoints(appendPolylineElement(out, shifted, window, decimation,
+                    Fill(), series[i].getStroke()));
+            }
+
+            // Make the axis 10% wider and higher than the data points.
+            double left = shift.x + margin.width;
+            double bottom = shift.y + margin.height;
+            double width = (range.max.x - range.min.x) * 1.1;
+            double height = (range.max.y - range.min.y) * 1.1;
+            Polyline axis(Color::Transparent, axis_stroke);
+            axis << Point(left, bottom + height) << Point(left, bottom)
+                << Point(left + width, bottom);
+            axis.serialize(out, layout);
+        }
+        void offset(Point const & offset)
+        {
+            shift.x += offset.x;
+            shift.y += offset.y;
+        }
+        Shape * clone() const
+        {
+            return new RollingLineChart(*this);
+        }
+    private:
+        std::size_t capacity;
+        Stroke axis_stroke;
+        Dimensions margin;
+        Decimation decimation;
+        // Total of the offset() calls.
+        Point shift;
+        std::vector<RollingSeries> series;
+    };
+
+    // Output stage applied when a document is written.  Gzip produces .svgz
+    //  files and requires building with SIMPLE_SVG_USE_ZLIB and linking zlib;
+    //  without it, writing a gzip document fails.
+    struct Compression
+    {
+        enum Format { None, Gzip };
+
+        Compression(Format format = None, int level = 6) : format(format), level(level) { }
+        static Compression gzip(int level = 6) { return Compression(Gzip, level); }
+
+        Format format;
+        // zlib level, from 0 (store only) to 9 (smallest output).
+        int level;
+    };
+    inline bool compressionAvailable(Compression const & compression)
+    {
+#ifdef SIMPLE_SVG_USE_ZLIB
+        (void)compression;
+        return true;
+#else
+        return compression.format == Compression::None;
+#endif
+    }
+
+    // Bytes of SVG produced and bytes actually written after compression.
+    //  Both are equal for uncompressed output.
+    struct OutputStats
+    {
+        OutputStats() : raw_bytes(0), compressed_bytes(0) { }
+        unsigned long long raw_bytes;
+        unsigned long long compressed_bytes;
+    };
+
+#ifdef SIMPLE_SVG_USE_ZLIB
+    // std::streambuf that gzip-compresses everything written to it into
+    //  another stream as it arrives.  finish() writes the gzip trailer; it is
+    //  called on destruction if it was not called before.
+    class GzipStreambuf : public std::streambuf
+    {
+    public:
+        GzipStreambuf(std::ostream & sink, int level = 6, std::size_t buffer_size = 1 << 16)
+            : sink(sink), input(buffer_size), output(buffer_size), raw_bytes(0),
+            compressed_bytes(0), finished(false)
+        {
+            zstream.zalloc = Z_NULL;
+            zstream.zfree = Z_NULL;
+            zstream.opaque = Z_NULL;
+            // 16 + MAX_WBITS selects the gzip wrapper instead of zlib's.
+            initialized = deflateInit2(&zstream, level, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                Z_DEFAULT_STRATEGY) == Z_OK;
+            ok = initialized;
+            setp(&input[0], &input[0] + input.size());
+        }
+        ~GzipStreambuf()
+        {
+            finish();
+            if (initialized)
+                deflateEnd(&zstream);
+        }
+        bool finish()
+        {
+            if (!finished) {
+                deflateInput(Z_FINISH);
+                finished = true;
+            }
+            return ok && sink.good();
+        }
+        unsigned long long rawBytes() const
+        {
+            return raw_bytes + (pptr() - pbase());
+        }
+        unsigned long long compressedBytes() const
+        {
+            return compressed_bytes;
+        }
+    protected:
+        int_type overflow(int_type ch)
+        {
+            if (finished || !deflateInput(Z_NO_FLUSH))
+                return traits_type::eof();
+            if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+        int sync()
+        {
+            if (!finished && !deflateInput(Z_NO_FLUSH))
+                return -1;
+            return sink.flush().good() ? 0 : -1;
+        }
+    private:
+        GzipStreambuf(GzipStreambuf const &);
+        GzipStreambuf & operator=(GzipStreambuf const &);
+
+        // Compresses the pending input and writes whatever zlib produces.
+        bool deflateInput(int flush)
+        {
+            if (!ok)
+                return false;
+
+            zstream.next_in = reinterpret_cast<Bytef *>(pbase());
+            zstream.avail_in = static_cast<uInt>(pptr() - pbase());
+            raw_bytes += zstream.avail_in;
+            int status;
+            do {
+                zstream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+                zstream.avail_out = static_cast<uInt>(output.size());
+                status = deflate(&zstream, flush);
+                if (status == Z_STREAM_ERROR) {
+                    ok = false;
+                    return false;
+                }
+                std::size_t produced = output.size() - zstream.avail_out;
+                sink.write(&output[0], produced);
+                compressed_bytes += produced;
+            } while (zstream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+            setp(pbase(), epptr());
+
+            ok = sink.good();
+            return ok;
+        }
+
+        std::ostream & sink;
+        std::vector<char> input;
+        std::vector<char> output;
+        z_stream zstream;
+        unsigned long long raw_bytes;
+        unsigned long long compressed_bytes;
+        bool initialized;
+        bool ok;
+        bool finished;
+    };
+#endif
+
+    // Indices [0, count) split into one contiguous share per thread, for
+    //  tasks of uneven cost.  Each thread takes indices from the front of its
+    //  own share; one that runs out steals the upper half of another thread's
+    //  remaining share, so all threads stay busy until the end.
+    class WorkQueue
+    {
+    public:
+        WorkQueue(std::size_t count, unsigned threads) : shares(threads)
+        {
+            for (unsigned i = 0; i < threads; ++i) {
+                shares[i].begin = count * i / threads;
+                shares[i].end = count * (i + 1) / threads;
+            }
+        }
+        // Sets index to the next index for thread self.  Returns false once
+        //  every share is empty.
+        bool next(unsigned self, std::size_t & index)
+        {
+            Share & own = shares[self];
+            for (;;) {
+                {
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    if (own.begin < own.end) {
+                        index = own.begin++;
+                        return true;
+                    }
+                }
+                if (!steal(self))
+                    return false;
+            }
+        }
+    private:
+        struct Share
+        {
+            Share() : begin(0), end(0) { }
+            std::mutex mutex;
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        // Moves half of some other share into the empty share of self.
+        //  Indices in transit are always owned by a running thread, so none
+        //  are lost.
+        bool steal(unsigned self)
+        {
+            unsigned threads = static_cast<unsigned>(shares.size());
+            for (unsigned offset = 1; offset < threads; ++offset) {
+                Share & victim = shares[(self + offset) % threads];
+                std::size_t begin, end;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    if (victim.begin == victim.end)
+                        continue;
+                    begin = victim.begin + (victim.end - victim.begin) / 2;
+                    end = victim.end;
+                    victim.end = begin;
+                }
+                std::lock_guard<std::mutex> lock(shares[self].mutex);
+                shares[self].begin = begin;
+                shares[self].end = end;
+                return true;
+            }
+            return false;
+        }
+
+        std::vector<Share> shares;
+    };
+
+    // Threads that are started once and then reused by every run(), so that
+    //  callers which fan out many times, such as a document serialized in
+    //  rounds, do not pay for creating threads each time.  The thread calling
+    //  run() is one of the workers, so WorkerPool(1) starts no threads.
+    class WorkerPool
+    {
+    public:
+        explicit WorkerPool(unsigned threads)
+            : job(0), job_threads(0), generation(0), active(0), stopping(false)
+        {
+            for (unsigned i = 1; i < threads; ++i)
+                helpers.emplace_back(&WorkerPool::helperLoop, this, i);
+        }
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& helper : helpers)
+                helper.join();
+        }
+        unsigned size() const { return static_cast<unsigned>(helpers.size() + 1); }
+
+        // Calls task(worker, i) for every i in [0, count) and returns when all
+        //  calls are done.  worker numbers the threads from 0, the calling
+        //  one, for per-thread state.  Indices are handed out as by WorkQueue.
+        //  Calls from several threads take turns.  If a call throws, no more
+        //  indices are handed out, and once the calls under way are done
+        //  run() rethrows the first exception.
+        template <typename Task>
+        void run(std::size_t count, Task task)
+        {
+            if (count == 0)
+                return;
+            std::lock_guard<std::mutex> running(run_mutex);
+            unsigned threads = count < size() ? static_cast<unsigned>(count) : size();
+            WorkQueue queue(count, threads);
+            std::exception_ptr error;
+            std::atomic<bool> failed(false);
+            std::function<void(unsigned)> work = [&](unsigned self) {
+                try {
+                    std::size_t index;
+                    while (!failed && queue.next(self, index))
+                        task(self, index);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                        error = std::current_exception();
+                    failed = true;
+                }
+            };
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = &work;
+                job_threads = threads;
+                active = threads - 1;
+                ++generation;
+            }
+            wake.notify_all();
+            work(0);
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() { return active == 0; });
+            job = 0;
+            if (error)
+                std::rethrow_exception(error);
+        }
+    private:
+        WorkerPool(WorkerPool const &);
+        WorkerPool & operator=(WorkerPool const &);
+
+        void helperLoop(unsigned self)
+        {
+            unsigned long long seen = 0;
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                if (self >= job_threads)
+                    continue;
+                std::function<void(unsigned)> const * work = job;
+                lock.unlock();
+                (*work)(self);
+                lock.lock();
+                if (--active == 0)
+                    done.notify_one();
+            }
+        }
+
+        std::mutex run_mutex;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::function<void(unsigned)> const * job;
+        unsigned job_threads;
+        unsigned long long generation;
+        unsigned active;
+        bool stopping;
+        std::vector<std::thread> helpers;
+    };
+
+    // One-off form of WorkerPool::run() for callers that fan out once: calls
+    //  task(worker, i) for every i in [0, count) on up to `threads` threads
+    //  including the calling one.
+    template <typename Task>
+    inline void workStealingFor(std::size_t count, unsigned threads, Task task)
+    {
+        if (count == 0)
+            return;
+        if (threads < 1)
+            threads = 1;
+        if (threads > count)
+            threads = static_cast<unsigned>(count);
+        WorkerPool pool(threads);
+        pool.run(count, task);
+    }
+
+    // Document prologue and epilogue shared by Document and StreamingDocument.
+    inline void appendDocumentStart(std::string & out, Layout const & layout)
+    {
+        out += "<?xml ";
+        appendAttribute(out, "version", "1.0");
+        appendAttribute(out, "standalone", "no");
+        out += "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
+            "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg ";
+        appendAttribute(out, "width", layout.dimensions.width, NumberFormat(), "px");
+        appendAttribute(out, "height", layout.dimensions.height, NumberFormat(), "px");
+        appendAttribute(out, "xmlns", "http://www.w3.org/2000/svg");
+        appendAttribute(out, "xmlns:xlink", "http://www.w3.org/1999/xlink");
+        appendAttribute(out, "version", "1.1");
+        out += ">\n";
+    }
+    inline void appendDocumentEnd(std::string & out)
+    {
+        appendElemEnd(out, "svg");
+    }
+
+    // A piece of output, for writing several buffers with one call.
+    struct OutputChunk
+    {
+        OutputChunk(char const * data, std::size_t size) : data(data), size(size) { }
+        char const * data;
+        std::size_t size;
+    };
+
+    // Destination of a serialized document, see Document::writeTo().  Write
+    //  calls return false once writing has failed.
+    class Sink
+    {
+    public:
+        virtual ~Sink() { }
+        virtual bool write(char const * data, std::size_t size) = 0;
+        // Writes the chunks in order.  Sinks that can hand several buffers to
+        //  the system at once override this.
+        virtual bool writeChunks(OutputChunk const * chunks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+                if (!write(chunks[i].data, chunks[i].size))
+                    return false;
+            return true;
+        }
+    };
+
+    class OStreamSink : public Sink
+    {
+    public:
+        explicit OStreamSink(std::ostream & stream) : stream(stream) { }
+        bool write(char const * data, std::size_t size)
+        {
+            stream.write(data, size);
+            return stream.good();
+        }
+    private:
+        std::ostream & stream;
+    };
+
+    // Appends to a string owned by the caller.
+    class StringSink : public Sink
+    {
+    public:
+        explicit StringSink(std::string & out) : out(out) { }
+        bool write(char const * data, std::size_t size)
+        {
+            out.append(data, size);
+            return true;
+        }
+    private:
+        std::string & out;
+    };
+
+    // Passes everything on to target and counts the bytes.
+    class CountingSink : public Sink
+    {
+    public:
+        explicit CountingSink(Sink & target) : target(target), bytes(0) { }
+        bool write(char const * data, std::size_t size)
+        {
+            bytes += size;
+            return target.write(data, size);
+        }
+        bool writeChunks(OutputChunk const * chunks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+                bytes += chunks[i].size;
+            return target.writeChunks(chunks, count);
+        }
+        unsigned long long byteCount() const
+        {
+            return bytes;
+        }
+    private:
+        Sink & target;
+        unsigned long long bytes;
+    };
+
+#ifdef SIMPLE_SVG_HAS_WRITEV
+    // Writes to a POSIX file descriptor: a file, pipe or socket.  Chunks go
+    //  to the kernel with writev(), up to 64 per call, straight from the
+    //  caller's buffers.  Requires SIMPLE_SVG_USE_POSIX.
+    class FileDescriptorSink : public Sink
+    {
+    public:
+        // Writes to fd, which is left open.
+        explicit FileDescriptorSink(int fd) : fd(fd), owned(false), failed(fd < 0) { }
+        // Creates or truncates file_name; good() tells whether that worked.
+        explicit FileDescriptorSink(std::string const & file_name)
+            : fd(::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)), owned(true),
+            failed(fd < 0) { }
+        ~FileDescriptorSink()
+        {
+            close();
+        }
+        bool good() const
+        {
+            return !failed;
+        }
+        bool write(char const * data, std::size_t size)
+        {
+            OutputChunk chunk(data, size);
+            return writeChunks(&chunk, 1);
+        }
+        bool writeChunks(OutputChunk const * chunks, std::size_t count)
+        {
+            std::size_t const batch = 64;
+            iovec vectors[batch];
+            // The first chunk not written completely, and how much of it was.
+            std::size_t next = 0;
+            std::size_t done = 0;
+            while (!failed && next < count) {
+                std::size_t used = 0;
+                for (; used < batch && next + used < count; ++used) {
+                    std::size_t skip = used == 0 ? done : 0;
+                    vectors[used].iov_base = const_cast<char *>(chunks[next + used].data + skip);
+                    vectors[used].iov_len = chunks[next + used].size - skip;
+                }
+                ssize_t result = ::writev(fd, vectors, static_cast<int>(used));
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result < 0) {
+                    failed = true;
+                    break;
+                }
+
+                std::size_t written = static_cast<std::size_t>(result);
+                while (next < count && written >= chunks[next].size - done) {
+                    written -= chunks[next].size - done;
+                    done = 0;
+                    ++next;
+                }
+                if (result == 0 && next < count) {
+                    failed = true;
+                    break;
+                }
+                done += written;
+            }
+            return !failed;
+        }
+        // Closes the file if the sink opened it.  Returns false if writing or
+        //  closing failed.
+        bool close()
+        {
+            if (owned && fd >= 0) {
+                if (::close(fd) != 0)
+                    failed = true;
+                fd = -1;
+            }
+            return !failed;
+        }
+    private:
+        FileDescriptorSink(FileDescriptorSink const &);
+        FileDescriptorSink & operator=(FileDescriptorSink const &);
+
+        int fd;
+        bool owned;
+        bool failed;
+    };
+#endif
+
+    // Creates file_name and passes write a sink for the document, compressed
+    //  as requested.  written receives the number of SVG bytes and the size
+    //  of the file.  Uncompressed output goes through writev() where it is
+    //  available and through std::ofstream elsewhere.
+    template <typename Write>
+    bool writeDocumentFile(std::string const & file_name, Compression const & compression,
+        Write write, OutputStats & written)
+    {
+        if (!compressionAvailable(compression))
+            return false;
+
+#ifdef SIMPLE_SVG_USE_ZLIB
+        if (compression.format == Compression::Gzip) {
+            std::ofstream ofs(file_name.c_str(), std::ios::out | std::ios::binary);
+            if (!ofs.good())
+                return false;
+            GzipStreambuf gzip(ofs, compression.level);
+            std::ostream gzip_stream(&gzip);
+            OStreamSink sink(gzip_stream);
+            bool ok = write(sink);
+            if (!gzip.finish() || !ok)
+                return false;
+            written.raw_bytes = gzip.rawBytes();
+            written.compressed_bytes = gzip.compressedBytes();
+            ofs.close();
+            return !ofs.fail();
+        }
+#endif
+
+#ifdef SIMPLE_SVG_HAS_WRITEV
+        FileDescriptorSink file(file_name);
+        if (!file.good())
+            return false;
+        CountingSink sink(file);
+        bool ok = write(sink);
+        written.raw_bytes = written.compressed_bytes = sink.byteCount();
+        return file.close() && ok;
+#else
+        std::ofstream ofs(file_name.c_str());
+        if (!ofs.good())
+            return false;
+        OStreamSink stream(ofs);
+        CountingSink sink(stream);
+        bool ok = write(sink);
+        written.raw_bytes = written.compressed_bytes = sink.byteCount();
+        ofs.close();
+        return !ofs.fail() && ok;
+#endif
+    }
+
+    // The double nearest to the digits in [begin, end), which may include a
+    //  '.', times 10^exponent.  strtod() does the rounding; it is given the
+    //  digits without a decimal point, so the C locale does not matter.
+    inline double roundDecimal(char const * begin, char const * end, int exponent)
+    {
+        // 768 significant digits decide the rounding of any double, later
+        //  ones only by whether they are all zero.
+        static std::size_t const significant = 768;
+        char digits[significant + 24];
+        std::size_t count = 0;
+        bool point = false, sticky = false;
+        for (; begin < end; ++begin) {
+            if (*begin == '.') {
+                point = true;
+                continue;
+            }
+            if (count == 0 && *begin == '0')
+                exponent -= point;
+            else if (count < significant) {
+                digits[count++] = *begin;
+                exponent -= point;
+            }
+            else {
+                exponent += !point;
+                sticky = sticky || *begin != '0';
+            }
+        }
+        if (count == 0)
+            return 0;
+        if (sticky) {
+            digits[count++] = '1';
+            --exponent;
+        }
+        std::snprintf(digits + count, sizeof digits - count, "e%d", exponent);
+        return std::strtod(digits, 0);
+    }
+
+    // Reads the next number of an attribute value such as points or d from
+    //  [text, end), skipping blanks and commas before it, and advances text
+    //  past it.  Accepts what appendNumber() and CompactEncoder write,
+    //  including ".5" and numbers run together like "1.5.5" or "1-2".
+    //  '.' is the decimal separator whatever the C locale is.
+    inline bool readNumber(char const *& text, char const * end, double & value)
+    {
+        static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+            1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        char const * p = text;
+        while (p < end && (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+'))
+            ++p;
+        char const * const first = p;
+
+        // Up to 18 digits are kept; later ones only move the exponent.
+        unsigned long long mantissa = 0;
+        int kept = 0, exponent = 0;
+        bool digits = false;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, digits = true) {
+            if (kept < 18) {
+                mantissa = mantissa * 10 + (*p - '0');
+                kept += mantissa != 0;
+            }
+            else
+                ++exponent;
+        }
+        if (p < end && *p == '.') {
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p, digits = true) {
+                if (kept < 18) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    kept += mantissa != 0;
+                    --exponent;
+                }
+            }
+        }
+        if (!digits)
+            return false;
+        char const * const last = p;
+        int written = 0;
+        if (p + 1 < end && (*p == 'e' || *p == 'E')
+            && ((p[1] >= '0' && p[1] <= '9') || p[1] == '-' || p[1] == '+')) {
+            ++p;
+            bool negative_exponent = *p == '-';
+            if (*p == '-' || *p == '+')
+                ++p;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p)
+                if (written < 10000)
+                    written = written * 10 + (*p - '0');
+            if (negative_exponent)
+                written = -written;
+        }
+        exponent += written;
+
+        // Correctly rounded while mantissa and 10^|exponent| are exact
+        //  doubles, as they are for what appendNumber() writes.  Longer or
+        //  larger numbers, such as the 17 digits appendShortest() may write,
+        //  are rounded by roundDecimal().
+        double result = static_cast<double>(mantissa);
+        if (mantissa > 1ULL << 53 || exponent < -22 || exponent > 22)
+            result = roundDecimal(first, last, written);
+        else if (exponent < 0)
+            result /= powers[-exponent];
+        else if (exponent > 0)
+            result *= powers[exponent];
+        value = negative ? -result : result;
+        text = p;
+        return true;
+    }
+
+    // An element found by SvgReader.  name and attributes point into the
+    //  text being read.
+    struct SvgElement
+    {
+        enum Kind { Start, End, Empty };
+
+        SvgElement() : kind(Empty), begin(0), end(0), name(0), name_length(0), attributes(0),
+            attributes_length(0) { }
+        bool is(char const * element_name) const
+        {
+            return std::strlen(element_name) == name_length
+                && std::memcmp(element_name, name, name_length) == 0;
+        }
+        // Stores the unescaped value of attribute_name.  Returns false if the
+        //  element does not have it.
+        bool attribute(char const * attribute_name, std::string & value) const
+        {
+            std::size_t const length = std::strlen(attribute_name);
+            char const * p = attributes;
+            char const * const last = attributes + attributes_length;
+            while (p < last) {
+                while (p < last && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+                    ++p;
+                char const * key = p;
+                while (p < last && *p != '=' && *p != ' ' && *p != '\t' && *p != '\n')
+                    ++p;
+                char const * key_end = p;
+                while (p < last && *p != '"' && *p != '\'')
+                    ++p;
+                if (p == last)
+                    return false;
+                char const quote = *p++;
+                char const * value_end = static_cast<char const *>(
+                    std::memchr(p, quote, last - p));
+                if (!value_end)
+                    return false;
+                if (static_cast<std::size_t>(key_end - key) == length
+                    && std::memcmp(key, attribute_name, length) == 0) {
+                    value.clear();
+                    appendUnescaped(value, p, value_end - p);
+                    return true;
+                }
+                p = value_end + 1;
+            }
+            return false;
+        }
+
+        Kind kind;
+        // Offsets of the '<' and of the byte after the '>' in the text.
+        std::size_t begin;
+        std::size_t end;
+        char const * name;
+        std::size_t name_length;
+        char const * attributes;
+        std::size_t attributes_length;
+    };
+
+    // Pull parser for SVG text in memory.  next() returns one element at a
+    //  time, skipping the XML declaration, the doctype, comments and CDATA
+    //  sections; nothing is copied and nothing past the element is looked
+    //  at.  Checks only what it needs to find the elements, so it is meant
+    //  for files this library wrote, not as a validating XML parser.
+    class SvgReader
+    {
+    public:
+        SvgReader(char const * text, std::size_t size) : text(text), size(size), position(0) { }
+
+        // Stores the next element and returns true, or returns false at the
+        //  end of the text.
+        bool next(SvgElement & element)
+        {
+            for (;;) {
+                char const * open = find("<", position);
+                if (!open)
+                    return false;
+                std::size_t at = open - text;
+                char const * terminator = 0;
+                if (startsWith(at, "<!--"))
+                    terminator = "-->";
+                else if (startsWith(at, "<![CDATA["))
+                    terminator = "]]>";
+                else if (startsWith(at, "<?"))
+                    terminator = "?>";
+                else if (startsWith(at, "<!"))
+                    terminator = ">";
+                if (!terminator)
+                    return readTag(at, element);
+
+                char const * skip_to = find(terminator, at + 2);
+                if (!skip_to) {
+                    position = size;
+                    return false;
+                }
+                position = skip_to - text + std::strlen(terminator);
+            }
+        }
+        // The unescaped character data from the current position, usually the
+        //  end of the last element, to the next tag.
+        std::string textContent() const
+        {
+            char const * open = find("<", position);
+            std::size_t end = open ? open - text : size;
+            std::string content;
+            appendUnescaped(content, text + position, end - position);
+            return content;
+        }
+        std::size_t tell() const
+        {
+            return position;
+        }
+        void seek(std::size_t offset)
+        {
+            position = offset < size ? offset : size;
+        }
+    private:
+        bool startsWith(std::size_t at, char const * prefix) const
+        {
+            std::size_t length = std::strlen(prefix);
+            return at + length <= size && std::memcmp(text + at, prefix, length) == 0;
+        }
+        // First occurrence of needle at or after from, or null.
+        char const * find(char const * needle, std::size_t from) const
+        {
+            std::size_t const length = std::strlen(needle);
+            while (from + length <= size) {
+                char const * candidate = static_cast<char const *>(
+                    std::memchr(text + from, needle[0], size - from - length + 1));
+                if (!candidate)
+                    return 0;
+                if (std::memcmp(candidate, needle, length) == 0)
+                    return candidate;
+                from = candidate - text + 1;
+            }
+            return 0;
+        }
+        bool readTag(std::size_t at, SvgElement & element)
+        {
+            std::size_t p = at + 1;
+            element.kind = SvgElement::Start;
+            if (p < size && text[p] == '/') {
+                element.kind = SvgElement::End;
+                ++p;
+            }
+            element.name = text + p;
+            while (p < size && text[p] != '>' && text[p] != '/' && text[p] != ' '
+                && text[p] != '\t' && text[p] != '\n' && text[p] != '\r')
+                ++p;
+            element.name_length = text + p - element.name;
+            element.attributes = text + p;
+
+            // Find the '>', which may appear in quoted attribute values.
+            char quote = 0;
+            for (; p < size; ++p) {
+                if (quote) {
+                    if (text[p] == quote)
+                        quote = 0;
+                }
+                else if (text[p] == '"' || text[p] == '\'')
+                    quote = text[p];
+                else if (text[p] == '>')
+                    break;
+            }
+            if (p == size) {
+                position = size;
+                return false;
+            }
+            std::size_t attributes_end = p;
+            if (text[p - 1] == '/' && element.kind == SvgElement::Start) {
+                element.kind = SvgElement::Empty;
+                --attributes_end;
+            }
+            element.attributes_length = attributes_end
+                - static_cast<std::size_t>(element.attributes - text);
+            element.begin = at;
+            element.end = p + 1;
+            position = p + 1;
+            return true;
+        }
+
+        char const * text;
+        std::size_t size;
+        std::size_t position;
+    };
+
+    // Converts coordinates in SVG native space back to user space, the
+    //  inverse of translateX(), translateY() and translateScale().
+    inline double inverseTranslateX(double x, Layout const & layout)
+    {
+        if (layout.origin == Layout::BottomRight || layout.origin == Layout::TopRight)
+            return (layout.dimensions.width - x) / layout.scale - layout.origin_offset.x;
+        else
+            return x / layout.scale - layout.origin_offset.x;
+    }
+    inline double inverseTranslateY(double y, Layout const & layout)
+    {
+        if (layout.origin == Layout::BottomLeft || layout.origin == Layout::BottomRight)
+            return (layout.dimensions.height - y) / layout.scale - layout.origin_offset.y;
+        else
+            return y / layout.scale - layout.origin_offset.y;
+    }
+    inline double inverseTranslateScale(double dimension, Layout const & layout)
+    {
+        return dimension / layout.scale;
+    }
+
+    // Read-only access to an SVG file, for adding to documents written
+    //  earlier without reading them whole.  The file is memory-mapped with
+    //  SIMPLE_SVG_USE_POSIX, so only the pages looked at are read from disk;
+    //  elsewhere it is loaded into memory.  The closing tag and the last
+    //  <style> element are found by searching back from the end of the file,
+    //  which reads back to its start only if there is no <style> element,
+    //  and <defs> by reading forward to the first element in <svg>, which is
+    //  where Document puts them.  A document appended to several times has
+    //  a <style> element per append; readShape() collects the classes of
+    //  all of them, in one pass over the text when it first needs them.
+    class SvgFileReader
+    {
+    public:
+        // A range of the file: the whole element from begin to end, and its
+        //  content from content_begin to content_end.
+        struct Section
+        {
+            Section() : begin(0), end(0), content_begin(0), content_end(0) { }
+            std::size_t begin;
+            std::size_t end;
+            std::size_t content_begin;
+            std::size_t content_end;
+        };
+
+        static std::size_t const npos = static_cast<std::size_t>(-1);
+
+        explicit SvgFileReader(std::string const & file_name)
+            : text(0), size(0), mapped(false), closing_tag(npos), has_style(false),
+            class_count(0)
+        {
+            if (!load(file_name))
+                return;
+            closing_tag = findBack("</svg", size);
+            if (closing_tag != npos)
+                has_style = findLastStyle();
+        }
+        ~SvgFileReader()
+        {
+#ifdef SIMPLE_SVG_HAS_MMAP
+            if (mapped)
+                ::munmap(const_cast<char *>(text), size);
+#endif
+        }
+
+        // Whether the file could be read and ends in a closing </svg> tag.
+        bool good() const
+        {
+            return closing_tag != npos;
+        }
+        char const * data() const
+        {
+            return text;
+        }
+        std::size_t fileSize() const
+        {
+            return size;
+        }
+        // Offset of the closing </svg> tag.
+        std::size_t closingTag() const
+        {
+            return closing_tag;
+        }
+        // Finds the <defs> element if it is the first one in <svg>.
+        bool defs(Section & section) const
+        {
+            SvgReader reader(text, closing_tag == npos ? 0 : closing_tag);
+            SvgElement element;
+            while (reader.next(element) && !element.is("svg")) { }
+            if (!reader.next(element) || element.kind != SvgElement::Start || !element.is("defs"))
+                return false;
+            section.begin = element.begin;
+            section.content_begin = element.end;
+            int depth = 1;
+            while (reader.next(element)) {
+                if (element.kind == SvgElement::Start && element.is("defs"))
+                    ++depth;
+                else if (element.kind == SvgElement::End && element.is("defs") && --depth == 0) {
+                    section.content_end = element.begin;
+                    section.end = element.end;
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Finds the last <style> element in <svg>.
+        bool style(Section & section) const
+        {
+            section = style_section;
+            return has_style;
+        }
+        // One past the highest "sN" class of the last <style> element.  Each
+        //  append numbers its classes after those before it, so this is the
+        //  first number free for the next one, see Document::setAppend().
+        std::size_t styleClassCount() const
+        {
+            return class_count;
+        }
+        // Reads all elements before the closing tag, from the start.
+        SvgReader reader() const
+        {
+            return SvgReader(text, closing_tag == npos ? size : closing_tag);
+        }
+
+        // Rebuilds the shape that element was written from, for the basic
+        //  shapes this library writes: circle, ellipse, rect, line, polyline,
+        //  polygon, path and text.  Returns null for other elements.
+        //  Coordinates are mapped back with layout, which should be the
+        //  layout the file was written with.  Style classes are looked up in
+        //  the <style> elements.  For text, reader must be positioned right
+        //  after the element, as it is when next() has returned it.
+        std::unique_ptr<Shape> readShape(SvgElement const & element, SvgReader const & reader,
+            Layout const & layout) const
+        {
+            std::unique_ptr<Shape> shape;
+            if (element.kind == SvgElement::End)
+                return shape;
+
+            Fill fill(readColor(element, "fill"));
+            Stroke stroke;
+            double stroke_width;
+            if (number(element, "stroke-width", stroke_width)) {
+                std::string effect;
+                stroke = Stroke(inverseTranslateScale(stroke_width, layout),
+                    readColor(element, "stroke"), property(element, "vector-effect", effect)
+                    && effect == "non-scaling-stroke");
+            }
+
+            double a, b, c, d;
+            if (element.is("circle") && point(element, "cx", "cy", a, b) && number(element, "r", c))
+                shape.reset(new Circle(Point(inverseTranslateX(a, layout),
+                    inverseTranslateY(b, layout)), 2 * inverseTranslateScale(c, layout),
+                    fill, stroke));
+            else if (element.is("ellipse") && point(element, "cx", "cy", a, b)
+                && point(element, "rx", "ry", c, d))
+                shape.reset(new Elipse(Point(inverseTranslateX(a, layout),
+                    inverseTranslateY(b, layout)), 2 * inverseTranslateScale(c, layout),
+                    2 * inverseTranslateScale(d, layout), fill, stroke));
+            else if (element.is("rect") && point(element, "x", "y", a, b)
+                && point(element, "width", "height", c, d))
+                shape.reset(new Rectangle(Point(inverseTranslateX(a, layout),
+                    inverseTranslateY(b, layout)), inverseTranslateScale(c, layout),
+                    inverseTranslateScale(d, layout), fill, stroke));
+            else if (element.is("line") && point(element, "x1", "y1", a, b)
+                && point(element, "x2", "y2", c, d))
+                shape.reset(new Line(Point(inverseTranslateX(a, layout),
+                    inverseTranslateY(b, layout)), Point(inverseTranslateX(c, layout),
+                    inverseTranslateY(d, layout)), stroke));
+            else if (element.is("polyline") || element.is("polygon")) {
+                std::string points;
+                if (!element.attribute("points", points))
+                    return shape;
+                std::vector<Point> user_points;
+                char const * p = points.data();
+                char const * const end = p + points.size();
+                while (readNumber(p, end, a) && readNumber(p, end, b))
+                    user_points.push_back(Point(inverseTranslateX(a, layout),
+                        inverseTranslateY(b, layout)));
+                if (element.is("polyline"))
+                    shape.reset(new Polyline(std::move(user_points), fill, stroke));
+                else
+                    shape.reset(new Polygon(std::move(user_points), fill, stroke));
+            }
+            else if (element.is("path"))
+                shape = readPath(element, layout, fill, stroke);
+            else if (element.is("text") && element.kind == SvgElement::Start
+                && point(element, "x", "y", a, b)) {
+                Font font;
+                std::string family;
+                if (number(element, "font-size", c) && property(element, "font-family", family))
+                    font = Font(inverseTranslateScale(c, layout), family);
+                shape.reset(new Text(Point(inverseTranslateX(a, layout),
+                    inverseTranslateY(b, layout)), reader.textContent(), fill, font, stroke));
+            }
+            return shape;
+        }
+    private:
+        SvgFileReader(SvgFileReader const &);
+        SvgFileReader & operator=(SvgFileReader const &);
+
+        bool load(std::string const & file_name)
+        {
+#ifdef SIMPLE_SVG_HAS_MMAP
+            int fd = ::open(file_name.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat status;
+            bool ok = ::fstat(fd, &status) == 0 && status.st_size > 0;
+            if (ok) {
+                void * address = ::mmap(0, static_cast<std::size_t>(status.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+                ok = address != MAP_FAILED;
+                if (ok) {
+                    text = static_cast<char const *>(address);
+                    size = static_cast<std::size_t>(status.st_size);
+                    mapped = true;
+                }
+            }
+            ::close(fd);
+            return ok;
+#else
+            std::ifstream ifs(file_name.c_str(), std::ios::in | std::ios::binary);
+            if (!ifs.good())
+                return false;
+            contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+            text = contents.data();
+            size = contents.size();
+            return size > 0;
+#endif
+        }
+        // Last occurrence of needle that starts before end, or npos.
+        std::size_t findBack(char const * needle, std::size_t end) const
+        {
+            std::size_t const length = std::strlen(needle);
+            for (std::size_t at = end; at-- > 0; )
+                if (text[at] == needle[0] && at + length <= size
+                    && std::memcmp(text + at, needle, length) == 0)
+                    return at;
+            return npos;
+        }
+        // First occurrence of needle in [begin, end), or end.
+        static char const * findForward(char const * needle, char const * begin,
+            char const * end)
+        {
+            std::size_t const length = std::strlen(needle);
+            for (char const * at = begin; (at = static_cast<char const *>(
+                std::memchr(at, needle[0], end - at))) != 0; ++at)
+                if (static_cast<std::size_t>(end - at) >= length
+                    && std::memcmp(at, needle, length) == 0)
+                    return at;
+            return end;
+        }
+        // Whether a "<style" at offset begins a <style> start tag.
+        bool isStyleTag(std::size_t begin) const
+        {
+            char const next = begin + 6 < size ? text[begin + 6] : '\0';
+            return next == '>' || next == ' ' || next == '\t' || next == '\n' || next == '\r';
+        }
+        bool findLastStyle()
+        {
+            static char const closing[] = "</style>";
+            std::size_t const close = findBack(closing, closing_tag);
+            if (close == npos)
+                return false;
+            std::size_t begin = close;
+            do
+                begin = findBack("<style", begin);
+            while (begin != npos && !isStyleTag(begin));
+            if (begin == npos)
+                return false;
+            char const * open_end = static_cast<char const *>(
+                std::memchr(text + begin, '>', close - begin));
+            if (!open_end)
+                return false;
+            style_section.begin = begin;
+            style_section.content_begin = open_end - text + 1;
+            style_section.content_end = close;
+            style_section.end = close + sizeof closing - 1;
+            forEachRule(open_end + 1, text + close,
+                [this](std::size_t id, char const *, char const *) {
+                    if (id >= class_count)
+                        class_count = id + 1;
+                });
+            return true;
+        }
+        // Calls rule(id, open, close) for each rule .sN{...} in [p, last),
+        //  see StyleSheet, with open and close at its braces.
+        template <typename Rule>
+        static void forEachRule(char const * p, char const * const last, Rule rule)
+        {
+            while ((p = static_cast<char const *>(std::memchr(p, '.', last - p))) != 0) {
+                char const * open = static_cast<char const *>(std::memchr(p, '{', last - p));
+                char const * close = open ? findCssDelimiter(open, last, '}') : last;
+                if (close == last)
+                    break;
+                if (p[1] == 's') {
+                    std::size_t id = std::strtoul(p + 2, 0, 10);
+                    if (id < 1000000)
+                        rule(id, open, close);
+                }
+                p = close + 1;
+            }
+        }
+        // The declarations of the classes of every <style> element, with the
+        //  XML entities replaced, read on first use.  A later rule for a class
+        //  replaces an earlier one.
+        std::vector<std::string> const & styleRules() const
+        {
+            std::call_once(rules_read, [this]() {
+                static char const closing[] = "</style>";
+                char const * p = text;
+                char const * const last = text + closing_tag;
+                while ((p = findForward("<style", p, last)) != last) {
+                    char const * open_end = static_cast<char const *>(
+                        std::memchr(p, '>', last - p));
+                    if (!open_end)
+                        break;
+                    if (!isStyleTag(p - text) || open_end[-1] == '/') {
+                        p = open_end;
+                        continue;
+                    }
+                    char const * close = findForward(closing, open_end + 1, last);
+                    if (close == last)
+                        break;
+                    forEachRule(open_end + 1, close,
+                        [this](std::size_t id, char const * open, char const * end) {
+                            if (id >= rules.size())
+                                rules.resize(id + 1);
+                            rules[id].clear();
+                            appendUnescaped(rules[id], open + 1, end - open - 1);
+                        });
+                    p = close + sizeof closing - 1;
+                }
+            });
+            return rules;
+        }
+
+        // Value of a presentation attribute, taken from the style class of
+        //  element if it has one.
+        bool property(SvgElement const & element, char const * name, std::string & value) const
+        {
+            if (element.attribute(name, value))
+                return true;
+            std::string class_name;
+            if (!element.attribute("class", class_name) || class_name.size() < 2
+                || class_name[0] != 's')
+                return false;
+            std::size_t id = std::strtoul(class_name.c_str() + 1, 0, 10);
+            std::vector<std::string> const & rules = styleRules();
+            if (id >= rules.size())
+                return false;
+
+            std::string const & rule = rules[id];
+            char const * const rule_end = rule.data() + rule.size();
+            std::size_t const length = std::strlen(name);
+            for (char const * at = rule.data(); at < rule_end; ) {
+                char const * colon = static_cast<char const *>(
+                    std::memchr(at, ':', rule_end - at));
+                if (!colon)
+                    break;
+                char const * end = findCssDelimiter(colon, rule_end, ';');
+                if (static_cast<std::size_t>(colon - at) == length
+                    && std::memcmp(at, name, length) == 0) {
+                    value.clear();
+                    appendCssValue(value, colon + 1, end);
+                    return true;
+                }
+                at = end + 1;
+            }
+            return false;
+        }
+        bool number(SvgElement const & element, char const * name, double & value) const
+        {
+            std::string text;
+            if (!property(element, name, text))
+                return false;
+            char const * p = text.data();
+            return readNumber(p, p + text.size(), value);
+        }
+        bool point(SvgElement const & element, char const * x_name, char const * y_name,
+            double & x, double & y) const
+        {
+            return number(element, x_name, x) && number(element, y_name, y);
+        }
+        // Colors as Color::serialize() writes them: "none" or "rgb(r,g,b)".
+        Color readColor(SvgElement const & element, char const * name) const
+        {
+            std::string text;
+            double red, green, blue;
+            if (!property(element, name, text) || text.compare(0, 4, "rgb(") != 0)
+                return Color::Transparent;
+            char const * p = text.data() + 4;
+            char const * end = text.data() + text.size();
+            if (!readNumber(p, end, red) || !readNumber(p, end, green) || !readNumber(p, end, blue))
+                return Color::Transparent;
+            return Color(static_cast<int>(red), static_cast<int>(green), static_cast<int>(blue));
+        }
+        // Path data as appendSubpath() writes it: absolute M with implicit
+        //  lines, or the relative l, h and v of PointEncoding::Compact.
+        std::unique_ptr<Shape> readPath(SvgElement const & element, Layout const & layout,
+            Fill const & fill, Stroke const & stroke) const
+        {
+            std::string data;
+            std::unique_ptr<Path> path(new Path(fill, stroke));
+            if (!element.attribute("d", data))
+                return std::unique_ptr<Shape>();
+
+            char const * p = data.data();
+            char const * const end = p + data.size();
+            char command = 'M';
+            double x = 0, y = 0;
+            for (;;) {
+                while (p < end && (*p == ' ' || *p == ','))
+                    ++p;
+                if (p == end)
+                    break;
+                if (*p && std::strchr("MmLlHhVvZz", *p)) {
+                    command = *p++;
+                    if (command == 'Z' || command == 'z' || command == 'M' || command == 'm')
+                        path->startNewSubPath();
+                    continue;
+                }
+                double a, b = 0;
+                if (!readNumber(p, end, a))
+                    break;
+                bool pair = command != 'H' && command != 'h' && command != 'V' && command != 'v';
+                if (pair && !readNumber(p, end, b))
+                    break;
+                switch (command)
+                {
+                    case 'M': case 'L': x = a; y = b; command = 'L'; break;
+                    case 'm': case 'l': x += a; y += b; command = 'l'; break;
+                    case 'H': x = a; break;
+                    case 'h': x += a; break;
+                    case 'V': y = a; break;
+                    case 'v': y += a; break;
+                    default: return std::unique_ptr<Shape>();
+                }
+                *path << Point(inverseTranslateX(x, layout), inverseTranslateY(y, layout));
+            }
+            return std::unique_ptr<Shape>(path.release());
+        }
+
+        char const * text;
+        std::size_t size;
+        bool mapped;
+#ifndef SIMPLE_SVG_HAS_MMAP
+        std::string contents;
+#endif
+        std::size_t closing_tag;
+        bool has_style;
+        Section style_section;
+        std::size_t class_count;
+        // See styleRules().
+        mutable std::once_flag rules_read;
+        mutable std::vector<std::string> rules;
+    };
+
+    // Opens the SVG document file_name and passes write a sink placed at
+    //  offset, where its closing </svg> tag was, for the new content and a
+    //  new closing tag.  What was left of the old tail is blanked with
+    //  spaces, which XML allows after the root element.  written receives
+    //  the number of bytes written.
+    template <typename Write>
+    bool appendDocumentFile(std::string const & file_name, std::size_t offset, Write write,
+        OutputStats & written)
+    {
+        std::fstream file(file_name.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        if (!file.good() || !file.seekg(0, std::ios::end))
+            return false;
+        unsigned long long old_size = static_cast<unsigned long long>(file.tellg());
+        if (old_size < offset || !file.seekp(static_cast<std::streamoff>(offset)))
+            return false;
+        OStreamSink stream(file);
+        CountingSink sink(stream);
+        bool ok = write(sink);
+        unsigned long long end = offset + sink.byteCount();
+        if (end < old_size) {
+            std::string blank(static_cast<std::size_t>(old_size - end), ' ');
+            file.write(blank.data(), blank.size());
+        }
+        written.raw_bytes = written.compressed_bytes = sink.byteCount();
+        file.close();
+        return !file.fail() && ok;
+    }
+
+    class Document
+    {
+    public:
+        Document(std::string const & file_name, Layout layout = Layout())
+            : file_name(file_name), layout(layout), threads(1), append(false), append_offset(0),
+            first_style_class(0), symbols(new SymbolTable())
+        {
+            this->layout.symbols = symbols.get();
+        }
+        // Copies own their style sheet, symbols, pending shapes and worker
+        //  threads.
+        Document(Document const & other)
+            : file_name(other.file_name), layout(other.layout), compression(other.compression),
+            threads(other.threads), append(other.append), append_offset(other.append_offset),
+            first_style_class(other.first_style_class),
+            style_sheet(other.style_sheet ? new StyleSheet(*other.style_sheet) : 0),
+            symbols(new SymbolTable(*other.symbols)),
+            definitions(other.definitions), sealed(other.sealed), body(other.body),
+            pool(threads > 1 ? new WorkerPool(threads) : 0)
+        {
+            if (other.style_sheet && layout.style_sheet == other.style_sheet.get())
+                layout.style_sheet = style_sheet.get();
+            layout.symbols = symbols.get();
+            pending.reserve(other.pending.size());
+            for (std::size_t i = 0; i < other.pending.size(); ++i)
+                pending.push_back(std::unique_ptr<Shape>(other.pending[i]->clone()));
+        }
+        Document(Document && other) = default;
+        Document & operator=(Document const & other)
+        {
+            Document copy(other);
+            return *this = std::move(copy);
+        }
+        Document & operator=(Document && other) = default;
+
+        // Applies to shapes added after the call.
+        void setNumberFormat(NumberFormat const & format)
+        {
+            serializePending();
+            layout.number_format = format;
+        }
+        // Applies to shapes added after the call.
+        void setPointEncoding(PointEncoding const & encoding)
+        {
+            serializePending();
+            layout.point_encoding = encoding;
+        }
+        // With more than one thread, added shapes are copied and serialized
+        //  in parallel chunks, then joined in their original order.  The
+        //  output is identical to the serial path.  Copies are serialized in
+        //  rounds of pending_round shapes per thread by threads the document
+        //  keeps for its lifetime, so at most one round of copies is alive.
+        //  Shapes that do not implement clone() are serialized immediately.
+        void setParallelSerialization(unsigned threads)
+        {
+            serializePending();
+            this->threads = threads;
+            pool.reset(threads > 1 ? new WorkerPool(threads) : 0);
+        }
+        // Writes the fill, stroke and font attributes of shapes added after
+        //  the call as class="sN" and emits each distinct combination once in
+        //  a <style> element.  The element goes at the end of the document,
+        //  which viewers apply to the whole document like any other.
+        //  Class numbers follow document order, so while style sharing is on,
+        //  shapes are serialized on the calling thread even in parallel mode.
+        void setStyleSharing(bool enabled)
+        {
+            serializePending();
+            if (enabled && !style_sheet)
+                style_sheet.reset(new StyleSheet(first_style_class));
+            layout.style_sheet = enabled ? style_sheet.get() : 0;
+        }
+        // Makes save() add to the document already in file_name instead of
+        //  replacing it.  The new definitions, shapes and <style> element
+        //  are written from where the closing </svg> tag of the file is at
+        //  this call, and nothing before it is rewritten, so saving costs
+        //  about as much as writing the additions.  Every save() writes all
+        //  additions from that point again, so saving twice gives the same
+        //  file; nothing else may change the file in between.  Style classes
+        //  are numbered after those of the last <style> element in the file,
+        //  which is found by searching back from its end.  The layout should
+        //  be the one the file was written with; the file must not be
+        //  compressed.  Returns false and changes nothing if shapes were
+        //  added already or file_name cannot be read as an SVG document.
+        bool setAppend(bool enabled)
+        {
+            if (!body.empty() || !sealed.empty() || !pending.empty())
+                return false;
+            std::size_t first_class = 0, offset = 0;
+            if (enabled) {
+                SvgFileReader reader(file_name);
+                if (!reader.good())
+                    return false;
+                first_class = reader.styleClassCount();
+                offset = reader.closingTag();
+            }
+            first_style_class = first_class;
+            append_offset = offset;
+            append = enabled;
+            if (style_sheet && style_sheet->size() == 0) {
+                bool sharing = layout.style_sheet != 0;
+                style_sheet.reset(new StyleSheet(first_style_class));
+                layout.style_sheet = sharing ? style_sheet.get() : 0;
+            }
+            return true;
+        }
+        // Leaves out shapes added after the call whose bounds lie entirely
+        //  outside the canvas, and collapses the off-canvas parts of
+        //  polylines and paths.  Off by default.
+        void setCulling(bool enabled)
+        {
+            serializePending();
+            layout.culling = enabled;
+        }
+        // Compression used by save(), none by default.
+        void setCompression(Compression const & compression)
+        {
+            this->compression = compression;
+        }
+#ifdef SIMPLE_SVG_STATS
+        // Collects statistics for shapes added after the call and for save().
+        //  stats is owned by the caller; null detaches it.
+        void setStats(SerializationStats * stats)
+        {
+            serializePending();
+            layout.stats = stats;
+        }
+#endif
+        // Adds shape to the <defs> of the document under id, to be placed any
+        //  number of times with Use.  The shape is drawn relative to the
+        //  position of each Use, with y pointing down.
+        void define(std::string const & id, Shape const & shape)
+        {
+            appendDefinition(definitions, id, shape, layout);
+        }
+        Document & operator<<(Shape const & shape)
+        {
+            if (layout.culling && !isVisible(shape.getBounds(), shape.getStroke(), layout))
+                return *this;
+            if (threads > 1 && !layout.style_sheet) {
+                std::unique_ptr<Shape> copy(shape.clone());
+                if (copy) {
+                    pending.push_back(std::move(copy));
+                    if (pending.size() >= pending_round * threads)
+                        serializePending();
+                    return *this;
+                }
+                serializePending();
+            }
+            shape.serialize(body, layout);
+            if (body.size() >= body_chunk_size)
+                sealBody();
+            return *this;
+        }
+        std::string toString() const
+        {
+            std::string out;
+            StringSink sink(out);
+            writeTo(sink);
+            return out;
+        }
+        // Writes the whole document to sink, e.g. a FileDescriptorSink on a
+        //  pipe or socket.  Returns false if the sink failed.
+        bool writeTo(Sink & sink) const
+        {
+            return writeParts(sink, documentHeader());
+        }
+        // Writes the document to file_name.  If stats is given, it receives the
+        //  number of SVG bytes and of bytes written to the file.
+        bool save(OutputStats * stats = 0) const
+        {
+#ifdef SIMPLE_SVG_STATS
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#endif
+            OutputStats written;
+            if (!writeFile(file_name, compression, append, append_offset, [this](Sink & sink) {
+                return writeParts(sink, append ? definitionsElement() : documentHeader());
+            }, written))
+                return false;
+            if (stats)
+                *stats = written;
+#ifdef SIMPLE_SVG_STATS
+            if (layout.stats) {
+                std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+                layout.stats->recordSave(written.compressed_bytes,
+                    static_cast<unsigned long long>(elapsed.count()));
+            }
+#endif
+            return true;
+        }
+        // Like save(), but the file is written by a background thread and the
+        //  call returns right away.  The writer shares the serialized body
+        //  with the document instead of copying it, and shapes added later
+        //  go into a new buffer, so they do not show up in this file.  stats
+        //  must stay valid until the future is ready.
+        std::future<bool> saveAsync(OutputStats * stats = 0)
+        {
+            serializePending();
+            sealBody();
+            std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+            snapshot->header = append ? definitionsElement() : documentHeader();
+            snapshot->body = sealed;
+            snapshot->footer = documentFooter();
+
+            std::string file_name = this->file_name;
+            Compression compression = this->compression;
+            bool append = this->append;
+            std::size_t append_offset = this->append_offset;
+            return std::async(std::launch::async, [=]() {
+                OutputStats written;
+                if (!writeFile(file_name, compression, append, append_offset, [&](Sink & sink) {
+                    return snapshot->writeTo(sink);
+                }, written))
+                    return false;
+                if (stats)
+                    *stats = written;
+                return true;
+            });
+        }
+    private:
+        // Body chunks are sealed at this size, so that saveAsync() can share
+        //  them while new shapes are appended to a fresh chunk.
+        static std::size_t const body_chunk_size = 1 << 20;
+        // Shapes per thread and round in parallel mode.
+        static std::size_t const pending_round = 8192;
+
+        // Everything saveAsync() needs, independent of the document.
+        struct Snapshot
+        {
+            bool writeTo(Sink & sink) const
+            {
+                std::vector<OutputChunk> chunks;
+                chunks.push_back(OutputChunk(header.data(), header.size()));
+                for (std::size_t i = 0; i < body.size(); ++i)
+                    chunks.push_back(OutputChunk(body[i]->data(), body[i]->size()));
+                chunks.push_back(OutputChunk(footer.data(), footer.size()));
+                return sink.writeChunks(chunks.data(), chunks.size());
+            }
+
+            std::string header;
+            std::vector<std::shared_ptr<std::string const> > body;
+            std::string footer;
+        };
+
+        // Writes a new file, or adds to the existing one at append_offset in
+        //  append mode.
+        template <typename Write>
+        static bool writeFile(std::string const & file_name, Compression const & compression,
+            bool append, std::size_t append_offset, Write write, OutputStats & written)
+        {
+            if (!append)
+                return writeDocumentFile(file_name, compression, write, written);
+            // Compressed files cannot be added to in place.
+            return compression.format == Compression::None
+                && appendDocumentFile(file_name, append_offset, write, written);
+        }
+        std::string documentHeader() const
+        {
+            std::string header;
+            appendDocumentStart(header, layout);
+            header += definitionsElement();
+            return header;
+        }
+        std::string definitionsElement() const
+        {
+            if (definitions.empty())
+                return std::string();
+            return "\t<defs>\n" + definitions + "\t</defs>\n";
+        }
+        // Writes header followed by the body and the footer.
+        bool writeParts(Sink & sink, std::string const & header) const
+        {
+            std::vector<OutputChunk> chunks;
+            chunks.push_back(OutputChunk(header.data(), header.size()));
+            for (std::size_t i = 0; i < sealed.size(); ++i)
+                chunks.push_back(OutputChunk(sealed[i]->data(), sealed[i]->size()));
+            chunks.push_back(OutputChunk(body.data(), body.size()));
+            bool ok = sink.writeChunks(chunks.data(), chunks.size());
+            forEachPendingChunk([&](std::string const & chunk) {
+                ok = ok && sink.write(chunk.data(), chunk.size());
+            });
+            std::string footer = documentFooter();
+            return ok && sink.write(footer.data(), footer.size());
+        }
+
+        std::string documentFooter() const
+        {
+            std::string footer;
+            symbols->serialize(footer);
+            if (style_sheet)
+                style_sheet->serialize(footer);
+            appendDocumentEnd(footer);
+            return footer;
+        }
+        void sealBody()
+        {
+            if (body.empty())
+                return;
+            sealed.push_back(std::make_shared<std::string const>(std::move(body)));
+            body.clear();
+        }
+        // Serializes the pending shapes in rounds of one chunk per thread and
+        //  passes the chunks to emit in their original order.  Buffers are
+        //  reused between rounds, so memory is bounded by the round size.
+        template <typename Emit>
+        void forEachPendingChunk(Emit emit) const
+        {
+            std::size_t const chunk_size = pending_round;
+            std::vector<std::string> chunks(threads);
+            for (std::size_t first = 0; first < pending.size(); first += chunk_size * threads) {
+                std::size_t round_end = first + chunk_size * threads;
+                if (round_end > pending.size())
+                    round_end = pending.size();
+                std::size_t round_chunks = (round_end - first + chunk_size - 1) / chunk_size;
+
+                pool->run(round_chunks, [&](unsigned, std::size_t chunk) {
+                    std::string & out = chunks[chunk];
+                    out.clear();
+                    std::size_t begin = first + chunk * chunk_size;
+                    std::size_t end = begin + chunk_size < round_end ? begin + chunk_size : round_end;
+                    for (std::size_t i = begin; i < end; ++i)
+                        pending[i]->serialize(out, layout);
+                });
+                for (std::size_t chunk = 0; chunk < round_chunks; ++chunk)
+                    emit(chunks[chunk]);
+            }
+        }
+        void serializePending()
+        {
+            forEachPendingChunk([&](std::string const & chunk) {
+                body += chunk;
+                if (body.size() >= body_chunk_size)
+                    sealBody();
+            });
+            pending.clear();
+        }
+
+    private:
+        std::string file_name;
+        Layout layout;
+        Compression compression;
+        unsigned threads;
+        // See setAppend().
+        bool append;
+        std::size_t append_offset;
+        std::size_t first_style_class;
+        std::unique_ptr<StyleSheet> style_sheet;
+        // Definitions registered by shapes, written after the body.
+        std::unique_ptr<SymbolTable> symbols;
+
+        // Serialized definitions, written in a <defs> element before the body.
+        std::string definitions;
+        // Serialized shapes: full chunks, possibly shared with a running
+        //  saveAsync(), followed by the chunk being appended to.
+        std::vector<std::shared_ptr<std::string const> > sealed;
+        std::string body;
+        // Shapes added in parallel mode and not serialized yet.  They follow
+        //  body in document order.
+        std::vector<std::unique_ptr<Shape> > pending;
+        // Serializes pending in parallel mode.
+        std::unique_ptr<WorkerPool> pool;
+    };
+
+    // Document that writes each shape out as soon as it is added instead of
+    //  keeping the body in memory.  The header is written on construction and
+    //  the closing tag on close() or destruction, so memory use stays at about
+    //  buffer_size bytes however large the document gets.
+    class StreamingDocument
+    {
+    public:
+        StreamingDocument(std::string const & file_name, Layout layout = Layout(),
+            Compression const & compression = Compression(), std::size_t buffer_size = 1 << 16)
+            : file(file_name.c_str(), compression.format == Compression::None
+                ? std::ios::out : std::ios::out | std::ios::binary),
+            stream(&file), layout(layout), buffer_size(buffer_size), closed(false)
+        {
+            start(compression);
+        }
+        StreamingDocument(std::ostream & stream, Layout layout = Layout(),
+            Compression const & compression = Compression(), std::size_t buffer_size = 1 << 16)
+            : stream(&stream), layout(layout), buffer_size(buffer_size), closed(false)
+        {
+            start(compression);
+        }
+        ~StreamingDocument()
+        {
+            close();
+        }
+
+        // Applies to shapes added after the call.
+        void setNumberFormat(NumberFormat const & format)
+        {
+            layout.number_format = format;
+        }
+        // Applies to shapes added after the call.
+        void setPointEncoding(PointEncoding const & encoding)
+        {
+            layout.point_encoding = encoding;
+        }
+        // See Document::setStyleSharing().  The <style> element is written by
+        //  close(), so the style sheet is the only part kept in memory.
+        void setStyleSharing(bool enabled)
+        {
+            if (enabled && !style_sheet)
+                style_sheet.reset(new StyleSheet());
+            layout.style_sheet = enabled ? style_sheet.get() : 0;
+        }
+        // See Document::setCulling().
+        void setCulling(bool enabled)
+        {
+            layout.culling = enabled;
+        }
+        // See Document::define().  The definition is written in place, and
+        //  can be referenced from anywhere in the document.
+        void define(std::string const & id, Shape const & shape)
+        {
+            if (closed)
+                return;
+
+            buffer += "\t<defs>\n";
+            appendDefinition(buffer, id, shape, layout);
+            buffer += "\t</defs>\n";
+            if (buffer.size() >= buffer_size)
+                flush();
+        }
+        StreamingDocument & operator<<(Shape const & shape)
+        {
+            if (closed)
+                return *this;
+            if (layout.culling && !isVisible(shape.getBounds(), shape.getStroke(), layout))
+                return *this;
+
+            shape.serialize(buffer, layout);
+            if (buffer.size() >= buffer_size)
+                flush();
+            return *this;
+        }
+        bool good() const
+        {
+            return !failed && stream->good() && (!file.is_open() || file.good());
+        }
+        // Bytes written so far.  Buffered bytes are not counted until flushed,
+        //  so the numbers are final after close().
+        OutputStats stats() const
+        {
+            OutputStats current;
+            current.raw_bytes = raw_bytes;
+            current.compressed_bytes = raw_bytes;
+#ifdef SIMPLE_SVG_USE_ZLIB
+            if (gzip)
+                current.compressed_bytes = gzip->compressedBytes();
+#endif
+            return current;
+        }
+        // Writes the closing tag and flushes.  Returns false if any write failed.
+        bool close()
+        {
+            if (!closed) {
+                symbols.serialize(buffer);
+                if (style_sheet)
+                    style_sheet->serialize(buffer);
+                appendDocumentEnd(buffer);
+                flush();
+                stream->flush();
+#ifdef SIMPLE_SVG_USE_ZLIB
+                if (gzip) {
+                    failed = !gzip->finish() || failed;
+                    stream = gzip_target;
+                    stream->flush();
+                }
+#endif
+                closed = true;
+                if (file.is_open())
+                    file.close();
+            }
+            return good();
+        }
+    private:
+        StreamingDocument(StreamingDocument const &);
+        StreamingDocument & operator=(StreamingDocument const &);
+
+        void start(Compression const & compression)
+        {
+            raw_bytes = 0;
+            failed = !compressionAvailable(compression);
+#ifdef SIMPLE_SVG_USE_ZLIB
+            if (compression.format == Compression::Gzip) {
+                gzip_target = stream;
+                gzip.reset(new GzipStreambuf(*stream, compression.level, buffer_size));
+                gzip_stream.reset(new std::ostream(gzip.get()));
+                stream = gzip_stream.get();
+            }
+#endif
+            layout.symbols = &symbols;
+            buffer.reserve(buffer_size);
+            appendDocumentStart(buffer, layout);
+        }
+        void flush()
+        {
+            if (failed)
+                return;
+
+            stream->write(buffer.data(), buffer.size());
+            raw_bytes += buffer.size();
+            buffer.clear();
+        }
+
+        std::ofstream file;
+        std::ostream * stream;
+        Layout layout;
+        std::size_t buffer_size;
+        bool closed;
+        bool failed;
+        unsigned long long raw_bytes;
+        std::unique_ptr<StyleSheet> style_sheet;
+        // Definitions registered by shapes, written on close().
+        SymbolTable symbols;
+#ifdef SIMPLE_SVG_USE_ZLIB
+        std::ostream * gzip_target;
+        std::unique_ptr<GzipStreambuf> gzip;
+        std::unique_ptr<std::ostream> gzip_stream;
+#endif
+
+        std::string buffer;
+    };
+
+    // Bump allocator that hands out memory from large blocks.  Memory is only
+    //  released all at once, by clear() or destruction, and destructors of
+    //  objects placed in it are not run, so it only holds objects that own
+    //  no other resources.
+    class Arena
+    {
+    public:
+        explicit Arena(std::size_t block_size = 1 << 20)
+            : block_size(block_size), current(0), remaining(0), reserved(0) { }
+        ~Arena()
+        {
+            clear();
+        }
+        void * allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+        {
+            std::size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(current) % alignment)
+                % alignment;
+            if (!current || padding + size > remaining) {
+                std::size_t block = size + alignment > block_size ? size + alignment : block_size;
+                blocks.push_back(new char[block]);
+                current = blocks.back();
+                remaining = block;
+                reserved += block;
+                padding = (alignment - reinterpret_cast<std::uintptr_t>(current) % alignment)
+                    % alignment;
+            }
+            char * result = current + padding;
+            current = result + size;
+            remaining -= padding + size;
+            return result;
+        }
+        // Copy-constructs count objects into the arena.
+        template <typename T>
+        T * copy(T const * source, std::size_t count)
+        {
+            T * target = static_cast<T *>(allocate(sizeof(T) * (count ? count : 1), alignof(T)));
+            for (std::size_t i = 0; i < count; ++i)
+                new (target + i) T(source[i]);
+            return target;
+        }
+        // Null-terminated copy of text.
+        char const * copy(std::string const & text)
+        {
+            char * target = static_cast<char *>(allocate(text.size() + 1, 1));
+            text.copy(target, text.size());
+            target[text.size()] = '\0';
+            return target;
+        }
+        void clear()
+        {
+            for (std::size_t i = 0; i < blocks.size(); ++i)
+                delete[] blocks[i];
+            blocks.clear();
+            current = 0;
+            remaining = 0;
+            reserved = 0;
+        }
+        std::size_t bytesReserved() const
+        {
+            return reserved;
+        }
+    private:
+        Arena(Arena const &);
+        Arena & operator=(Arena const &);
+
+        std::size_t block_size;
+        std::vector<char *> blocks;
+        char * current;
+        std::size_t remaining;
+        std::size_t reserved;
+    };
+
+    // Growable array stored in an Arena as chunks of contiguous elements.
+    //  Elements never move once added.
+    template <typename T>
+    class ArenaList
+    {
+    public:
+        ArenaList() : count(0) { }
+        T & push(Arena & arena, T const & value)
+        {
+            if (count % chunk_size == 0)
+                chunks.push_back(static_cast<T *>(arena.allocate(sizeof(T) * chunk_size, alignof(T))));
+            T * slot = chunks.back() + count % chunk_size;
+            new (slot) T(value);
+            ++count;
+            return *slot;
+        }
+        T const & operator[](std::size_t i) const
+        {
+            return chunks[i / chunk_size][i % chunk_size];
+        }
+        std::size_t size() const
+        {
+            return count;
+        }
+        // The memory itself belongs to the arena.
+        void clear()
+        {
+            chunks.clear();
+            count = 0;
+        }
+    private:
+        static std::size_t const chunk_size = 256;
+        std::vector<T *> chunks;
+        std::size_t count;
+    };
+
+    // Uniform grid over the boxes of a fixed set of items, numbered from 0,
+    //  for finding the items whose box meets an area.  Items with an empty
+    //  box, and items that would cover too many cells, are part of every
+    //  result.
+    class GridIndex
+    {
+    public:
+        GridIndex() : count(0), columns(0), rows(0), cell_width(1), cell_height(1) { }
+
+        // boxes[i] is the box of item i.
+        template <typename Boxes>
+        void build(Boxes const & boxes, std::size_t count)
+        {
+            clear();
+            this->count = count;
+            std::size_t known = 0;
+            for (std::size_t i = 0; i < count; ++i)
+                if (!boxes[i].empty) {
+                    extent.extend(boxes[i]);
+                    ++known;
+                }
+            if (!known) {
+                for (std::size_t i = 0; i < count; ++i)
+                    everywhere.push_back(i);
+                return;
+            }
+
+            // About one item per cell.
+            columns = rows = static_cast<std::size_t>(std::sqrt(static_cast<double>(known))) + 1;
+            cell_width = (extent.max.x - extent.min.x) / columns;
+            cell_height = (extent.max.y - extent.min.y) / rows;
+            if (!(cell_width > 0))
+                cell_width = 1;
+            if (!(cell_height > 0))
+                cell_height = 1;
+
+            // Counts the items per cell, then fills the cells in place.
+            std::size_t const max_cells = 64;
+            cell_start.assign(columns * rows + 1, 0);
+            for (std::size_t i = 0; i < count; ++i) {
+                Range range = cellRange(boxes[i]);
+                if (boxes[i].empty || range.cells() > max_cells)
+                    continue;
+                for (std::size_t row = range.first_row; row <= range.last_row; ++row) {
+                    std::size_t end = row * columns + range.last_column;
+                    for (std::size_t cell = row * columns + range.first_column; cell <= end; ++cell)
+                        ++cell_start[cell + 1];
+                }
+            }
+            for (std::size_t cell = 1; cell < cell_start.size(); ++cell)
+                cell_start[cell] += cell_start[cell - 1];
+            cell_items.resize(cell_start.back());
+            std::vector<std::size_t> filled(cell_start.begin(), cell_start.end() - 1);
+            for (std::size_t i = 0; i < count; ++i) {
+                Range range = cellRange(boxes[i]);
+                if (boxes[i].empty || range.cells() > max_cells) {
+                    everywhere.push_back(i);
+                    continue;
+                }
+                for (std::size_t row = range.first_row; row <= range.last_row; ++row) {
+                    std::size_t end = row * columns + range.last_column;
+                    for (std::size_t cell = row * columns + range.first_column; cell <= end; ++cell)
+                        cell_items[filled[cell]++] = i;
+                }
+            }
+        }
+        // Appends the items whose box may meet area to items, in increasing
+        //  order and without duplicates.
+        void query(Bounds const & area, std::vector<std::size_t> & items) const
+        {
+            std::size_t first = items.size();
+            if (area.intersects(extent)) {
+                Range range = cellRange(area);
+                for (std::size_t row = range.first_row; row <= range.last_row; ++row) {
+                    std::size_t end = row * columns + range.last_column;
+                    for (std::size_t cell = row * columns + range.first_column; cell <= end; ++cell)
+                        items.insert(items.end(), cell_items.begin() + cell_start[cell],
+                            cell_items.begin() + cell_start[cell + 1]);
+                }
+            }
+            items.insert(items.end(), everywhere.begin(), everywhere.end());
+            std::sort(items.begin() + first, items.end());
+            items.erase(std::unique(items.begin() + first, items.end()), items.end());
+        }
+        // Number of items indexed.
+        std::size_t size() const
+        {
+            return count;
+        }
+        void clear()
+        {
+            count = 0;
+            extent = Bounds();
+            columns = rows = 0;
+            cell_start.clear();
+            cell_items.clear();
+            everywhere.clear();
+        }
+    private:
+        struct Range
+        {
+            std::size_t first_column, last_column, first_row, last_row;
+            std::size_t cells() const
+            {
+                return (last_column - first_column + 1) * (last_row - first_row + 1);
+            }
+        };
+
+        std::size_t cell(double offset, double size, std::size_t cells) const
+        {
+            double index = std::floor(offset / size);
+            if (!(index > 0))
+                return 0;
+            return index >= cells ? cells - 1 : static_cast<std::size_t>(index);
+        }
+        Range cellRange(Bounds const & box) const
+        {
+            Range range;
+            range.first_column = cell(box.min.x - extent.min.x, cell_width, columns);
+            range.last_column = cell(box.max.x - extent.min.x, cell_width, columns);
+            range.first_row = cell(box.min.y - extent.min.y, cell_height, rows);
+            range.last_row = cell(box.max.y - extent.min.y, cell_height, rows);
+            return range;
+        }
+
+        std::size_t count;
+        Bounds extent;
+        std::size_t columns;
+        std::size_t rows;
+        double cell_width;
+        double cell_height;
+        // The items of cell c are cell_items[cell_start[c]] up to
+        //  cell_items[cell_start[c + 1]].
+        std::vector<std::size_t> cell_start;
+        std::vector<std::size_t> cell_items;
+        std::vector<std::size_t> everywhere;
+    };
+
+    // Document that keeps its shapes instead of their serialized text, so
+    //  the same scene can be rendered with any number of layouts, e.g. as a
+    //  thumbnail and at full size.  Built-in shapes are copied into an arena
+    //  with one contiguous list per shape type, including their point arrays
+    //  and strings, so rendering does not allocate per shape and clear() or
+    //  destruction releases everything at once.  Other shapes, including
+    //  subclasses of the built-in ones, are kept through cloneShape().
+    class RetainedDocument
+    {
+    public:
+        explicit RetainedDocument(std::size_t arena_block_size = 1 << 20)
+            : arena(arena_block_size), max_margin(0), max_non_scaling_margin(0) { }
+
+        RetainedDocument & operator<<(Circle const & circle)
+        {
+            if (typeid(circle) != typeid(Circle))
+                return add(circle);
+            circles.push(arena, circle);
+            return add(Circles, circles.size(), circle);
+        }
+        RetainedDocument & operator<<(Elipse const & ellipse)
+        {
+            if (typeid(ellipse) != typeid(Elipse))
+                return add(ellipse);
+            ellipses.push(arena, ellipse);
+            return add(Ellipses, ellipses.size(), ellipse);
+        }
+        RetainedDocument & operator<<(Rectangle const & rectangle)
+        {
+            if (typeid(rectangle) != typeid(Rectangle))
+                return add(rectangle);
+            rectangles.push(arena, rectangle);
+            return add(Rectangles, rectangles.size(), rectangle);
+        }
+        RetainedDocument & operator<<(Line const & line)
+        {
+            if (typeid(line) != typeid(Line))
+                return add(line);
+            lines.push(arena, line);
+            return add(Lines, lines.size(), line);
+        }
+        RetainedDocument & operator<<(Polyline const & polyline)
+        {
+            if (typeid(polyline) != typeid(Polyline))
+                return add(polyline);
+            PointsRecord record(polyline.getFill(), polyline.getStroke(),
+                arena.copy(polyline.points.data(), polyline.points.size()),
+                polyline.points.size(), polyline.getDecimation(), true);
+            point_lists.push(arena, record);
+            return add(PointLists, point_lists.size(), polyline);
+        }
+        RetainedDocument & operator<<(Polygon const & polygon)
+        {
+            if (typeid(polygon) != typeid(Polygon))
+                return add(polygon);
+            std::vector<Point> const & points = polygon.getPoints();
+            PointsRecord record(polygon.getFill(), polygon.getStroke(),
+                arena.copy(points.data(), points.size()), points.size(), Decimation(), false);
+            point_lists.push(arena, record);
+            return add(PointLists, point_lists.size(), polygon);
+        }
+        RetainedDocument & operator<<(Path const & path)
+        {
+            if (typeid(path) != typeid(Path))
+                return add(path);
+            std::vector<std::vector<Point> > const & subpaths = path.getSubpaths();
+            Subpath * copies = static_cast<Subpath *>(
+                arena.allocate(sizeof(Subpath) * (subpaths.size() + 1), alignof(Subpath)));
+            for (std::size_t i = 0; i < subpaths.size(); ++i)
+                new (copies + i) Subpath(arena.copy(subpaths[i].data(), subpaths[i].size()),
+                    subpaths[i].size());
+            PathRecord record(path.getFill(), path.getStroke(), copies, subpaths.size());
+            paths.push(arena, record);
+            return add(Paths, paths.size(), path);
+        }
+        RetainedDocument & operator<<(Text const & text)
+        {
+            if (typeid(text) != typeid(Text))
+                return add(text);
+            TextRecord record(text.getOrigin(), text.getFill(), text.getStroke(),
+                arena.copy(text.getContent()), text.getContent().size(),
+                text.getFont().getSize(), arena.copy(text.getFont().getFamily()));
+            texts.push(arena, record);
+            return add(Texts, texts.size(), text);
+        }
+        // Any other shape, kept through cloneShape().
+        RetainedDocument & operator<<(Shape const & shape)
+        {
+            return add(shape);
+        }
+
+        // Builds the grid index used by culled renders, see render().  Call
+        //  after adding shapes; it does nothing if the index is up to date.
+        void prepare()
+        {
+            if (index.size() != order.size())
+                index.build(bounds, order.size());
+        }
+        // Appends the body of the document, i.e. all shapes, rendered with
+        //  layout.  With layout.culling, the shapes on the canvas are looked up
+        //  in the grid index built by prepare(), so rendering a small window of
+        //  a large scene only touches the shapes near the window.  If shapes
+        //  were added since prepare(), every shape is tested instead.  render()
+        //  does not modify the document, so any number may run at once.
+        void render(std::string & out, Layout const & layout) const
+        {
+            Bounds area = visibleArea(layout, max_margin + max_non_scaling_margin / layout.scale);
+            if (!layout.culling || area.empty) {
+                for (std::size_t i = 0; i < order.size(); ++i)
+                    renderEntry(out, order[i], layout);
+                return;
+            }
+
+            if (index.size() != order.size()) {
+                for (std::size_t i = 0; i < order.size(); ++i)
+                    if (bounds[i].empty || bounds[i].intersects(area))
+                        renderEntry(out, order[i], layout);
+                return;
+            }
+            std::vector<std::size_t> visible;
+            index.query(area, visible);
+            for (std::size_t i = 0; i < visible.size(); ++i) {
+                Bounds const & box = bounds[visible[i]];
+                if (box.empty || box.intersects(area))
+                    renderEntry(out, order[visible[i]], layout);
+            }
+        }
+        std::string toString(Layout const & layout) const
+        {
+            std::string out;
+            appendDocumentStart(out, layout);
+            SymbolTable symbols;
+            Layout document = layout;
+            document.symbols = &symbols;
+            render(out, document);
+            symbols.serialize(out);
+            appendDocumentEnd(out);
+            return out;
+        }
+        bool save(std::string const & file_name, Layout const & layout) const
+        {
+            std::ofstream ofs(file_name.c_str());
+            if (!ofs.good())
+                return false;
+
+            std::string out = toString(layout);
+            ofs.write(out.data(), out.size());
+            ofs.close();
+            return !ofs.fail();
+        }
+
+        std::size_t size() const
+        {
+            return order.size();
+        }
+        // Removes all shapes and frees the arena.
+        void clear()
+        {
+            circles.clear();
+            ellipses.clear();
+            rectangles.clear();
+            lines.clear();
+            point_lists.clear();
+            paths.clear();
+            texts.clear();
+            order.clear();
+            bounds.clear();
+            index.clear();
+            max_margin = 0;
+            max_non_scaling_margin = 0;
+            others.clear();
+            arena.clear();
+        }
+        std::size_t bytesReserved() const
+        {
+            return arena.bytesReserved();
+        }
+    private:
+        RetainedDocument(RetainedDocument const &);
+        RetainedDocument & operator=(RetainedDocument const &);
+
+        enum Kind { Circles, Ellipses, Rectangles, Lines, PointLists, Paths, Texts, Others };
+
+        // Position of a shape in document order.
+        struct Entry
+        {
+            Entry(Kind kind, std::size_t index) : kind(kind), index(index) { }
+            Kind kind;
+            std::size_t index;
+        };
+        struct PointsRecord
+        {
+            PointsRecord(Fill const & fill, Stroke const & stroke, Point const * points,
+                std::size_t count, Decimation const & decimation, bool polyline)
+                : fill(fill), stroke(stroke), points(points), count(count),
+                decimation(decimation), polyline(polyline) { }
+            Fill fill;
+            Stroke stroke;
+            Point const * points;
+            std::size_t count;
+            Decimation decimation;
+            bool polyline;
+        };
+        struct Subpath
+        {
+            Subpath(Point const * points, std::size_t count) : points(points), count(count) { }
+            Point const * points;
+            std::size_t count;
+        };
+        struct PathRecord
+        {
+            PathRecord(Fill const & fill, Stroke const & stroke, Subpath const * subpaths,
+                std::size_t count)
+                : fill(fill), stroke(stroke), subpaths(subpaths), count(count) { }
+            Fill fill;
+            Stroke stroke;
+            Subpath const * subpaths;
+            std::size_t count;
+        };
+        struct TextRecord
+        {
+            TextRecord(Point const & origin, Fill const & fill, Stroke const & stroke,
+                char const * content, std::size_t length, double font_size,
+                char const * font_family)
+                : origin(origin), fill(fill), stroke(stroke), content(content), length(length),
+                font_size(font_size), font_family(font_family) { }
+            Point origin;
+            Fill fill;
+            Stroke stroke;
+            char const * content;
+            std::size_t length;
+            double font_size;
+            char const * font_family;
+        };
+
+        RetainedDocument & add(Shape const & shape)
+        {
+            others.push_back(std::unique_ptr<Shape>(cloneShape(shape)));
+            return add(Others, others.size(), shape);
+        }
+        // Records the last shape of a list in document order, along with the
+        //  bounds of shape.  The largest stroke margins are kept to grow the
+        //  visible area when culling; non-scaling ones are in pixels.
+        RetainedDocument & add(Kind kind, std::size_t list_size, Shape const & shape)
+        {
+            order.push(arena, Entry(kind, list_size - 1));
+            bounds.push(arena, shape.getBounds());
+            Stroke const & stroke = shape.getStroke();
+            double margin = strokeReach(stroke);
+            double & max = stroke.isNonScaling() ? max_non_scaling_margin : max_margin;
+            if (margin > max)
+                max = margin;
+            return *this;
+        }
+        void renderEntry(std::string & out, Entry const & entry, Layout const & layout) const
+        {
+            switch (entry.kind)
+            {
+                case Circles: circles[entry.index].serialize(out, layout); break;
+                case Ellipses: ellipses[entry.index].serialize(out, layout); break;
+                case Rectangles: rectangles[entry.index].serialize(out, layout); break;
+                case Lines: lines[entry.index].serialize(out, layout); break;
+                case PointLists: {
+                    PointsRecord const & record = point_lists[entry.index];
+                    if (record.polyline)
+                        appendPolylineElement(out, layout,
+                            CoordinateView(record.points, record.count), record.decimation,
+                            record.fill, record.stroke);
+                    else
+                        appendPointsElement(out, layout, "polygon",
+                            CoordinateView(record.points, record.count), record.fill, record.stroke);
+                    break;
+                }
+                case Paths: {
+                    PathRecord const & record = paths[entry.index];
+                    appendPathStart(out);
+                    for (std::size_t i = 0; i < record.count; ++i) {
+                        Subpath const & subpath = record.subpaths[i];
+                        if (subpath.count)
+                            appendSubpath(out, cullPoints(CoordinateView(subpath.points,
+                                subpath.count), layout, record.stroke), layout);
+                    }
+                    appendPathEnd(out, layout, record.fill, record.stroke);
+                    break;
+                }
+                case Texts: {
+                    TextRecord const & record = texts[entry.index];
+                    appendTextElement(out, layout, record.origin, record.content, record.length,
+                        record.fill, record.stroke, record.font_size, record.font_family);
+                    break;
+                }
+                case Others: others[entry.index]->serialize(out, layout); break;
+            }
+        }
+
+        Arena arena;
+        ArenaList<Circle> circles;
+        ArenaList<Elipse> ellipses;
+        ArenaList<Rectangle> rectangles;
+        ArenaList<Line> lines;
+        ArenaList<PointsRecord> point_lists;
+        ArenaList<PathRecord> paths;
+        ArenaList<TextRecord> texts;
+        ArenaList<Entry> order;
+        ArenaList<Bounds> bounds;
+        GridIndex index;
+        double max_margin;
+        double max_non_scaling_margin;
+        std::vector<std::unique_ptr<Shape> > others;
+    };
+
+    // Document for output that is saved again and again while only a few of
+    //  its shapes change, such as a live dashboard.  Every shape keeps its
+    //  last serialized fragment and a dirty flag, and save() serializes only
+    //  the shapes added or modified since the previous save; the others are
+    //  written from their cached fragments.  Shapes are kept through
+    //  cloneShape().  Definitions the shapes register, such as vertex
+    //  markers, are kept per shape, so those of replaced or removed shapes
+    //  are dropped.
+    class IncrementalDocument
+    {
+    public:
+        typedef std::size_t Handle;
+
+        IncrementalDocument(std::string const & file_name, Layout layout = Layout())
+            : file_name(file_name), layout(layout), order_stale(false), symbols_stale(false),
+            hits(0), misses(0) { }
+
+        // Marks every shape dirty, since all fragments depend on the layout.
+        void setLayout(Layout const & layout)
+        {
+            this->layout = layout;
+            for (std::size_t i = 0; i < entries.size(); ++i)
+                entries[i].dirty = true;
+        }
+        // Compression used by save(), none by default.
+        void setCompression(Compression const & compression)
+        {
+            this->compression = compression;
+        }
+
+        // Returns the handle used to update or remove the shape later.  The
+        //  shape is drawn on top of the others.  Handles of removed shapes are
+        //  handed out again.
+        Handle add(Shape const & shape)
+        {
+            Handle handle = entries.size();
+            if (free_handles.empty())
+                entries.push_back(Entry(cloneShape(shape)));
+            else {
+                compactOrder();
+                handle = free_handles.back();
+                free_handles.pop_back();
+                entries[handle] = Entry(cloneShape(shape));
+            }
+            order.push_back(handle);
+            return handle;
+        }
+        IncrementalDocument & operator<<(Shape const & shape)
+        {
+            add(shape);
+            return *this;
+        }
+        // Returns the shape for modification and marks it dirty.  T must be
+        //  the type the shape was added as, or std::bad_cast is thrown.
+        //  update(), replace() and remove() throw std::out_of_range for a
+        //  handle that was never returned by add() or has been removed.
+        template <typename T>
+        T & update(Handle handle)
+        {
+            Entry & entry = liveEntry(handle);
+            entry.dirty = true;
+            return dynamic_cast<T &>(*entry.shape);
+        }
+        void replace(Handle handle, Shape const & shape)
+        {
+            liveEntry(handle) = Entry(cloneShape(shape));
+        }
+        // Handles of the other shapes stay valid.  The handle itself may be
+        //  returned by a later add().
+        void remove(Handle handle)
+        {
+            liveEntry(handle) = Entry(0);
+            free_handles.push_back(handle);
+            order_stale = true;
+            symbols_stale = true;
+        }
+
+        // Writes the document to file_name.  If stats is given, it receives the
+        //  number of SVG bytes and of bytes written to the file.
+        bool save(OutputStats * stats = 0)
+        {
+            OutputStats written;
+            if (!writeDocumentFile(file_name, compression, [this](Sink & sink) {
+                return writeTo(sink);
+            }, written))
+                return false;
+            if (stats)
+                *stats = written;
+            return true;
+        }
+        std::string toString()
+        {
+            std::string out;
+            StringSink sink(out);
+            writeTo(sink);
+            return out;
+        }
+        // Writes the document to sink, with each cached fragment passed on as
+        //  a chunk of its own.  Returns false if the sink failed.
+        bool writeTo(Sink & sink)
+        {
+            refresh();
+            std::string header;
+            appendDocumentStart(header, layout);
+            std::string footer;
+            symbols.serialize(footer);
+            appendDocumentEnd(footer);
+
+            std::vector<OutputChunk> chunks;
+            chunks.reserve(order.size() + 2);
+            chunks.push_back(OutputChunk(header.data(), header.size()));
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                Entry const & entry = entries[order[i]];
+                if (entry.shape && !entry.fragment.empty())
+                    chunks.push_back(OutputChunk(entry.fragment.data(), entry.fragment.size()));
+            }
+            chunks.push_back(OutputChunk(footer.data(), footer.size()));
+            return sink.writeChunks(chunks.data(), chunks.size());
+        }
+
+        // Shapes written from their cached fragment and shapes serialized,
+        //  counted over all saves.
+        unsigned long long cacheHits() const
+        {
+            return hits;
+        }
+        unsigned long long cacheMisses() const
+        {
+            return misses;
+        }
+        void resetCacheCounters()
+        {
+            hits = 0;
+            misses = 0;
+        }
+    private:
+        struct Entry
+        {
+            explicit Entry(Shape * shape) : shape(shape), dirty(true) { }
+            std::unique_ptr<Shape> shape;
+            std::string fragment;
+            // Definitions registered by the shape, created when it registers
+            //  its first one.
+            std::unique_ptr<SymbolTable> symbols;
+            bool dirty;
+        };
+
+        Entry & liveEntry(Handle handle)
+        {
+            if (handle >= entries.size() || !entries[handle].shape)
+                throw std::out_of_range("svg: invalid or removed IncrementalDocument handle");
+            return entries[handle];
+        }
+        // Drops the handles of removed shapes from the drawing order, before
+        //  one of them is reused.
+        void compactOrder()
+        {
+            if (!order_stale)
+                return;
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < order.size(); ++i)
+                if (entries[order[i]].shape)
+                    order[kept++] = order[i];
+            order.resize(kept);
+            order_stale = false;
+        }
+        // Serializes the dirty shapes, each registering its definitions in a
+        //  table of its own, and gathers the tables of all shapes again if any
+        //  of them changed.
+        void refresh()
+        {
+            SymbolTable scratch;
+            Layout layout = this->layout;
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                Entry & entry = entries[i];
+                if (!entry.shape)
+                    continue;
+                if (!entry.dirty) {
+                    ++hits;
+                    continue;
+                }
+                entry.fragment.clear();
+                scratch.clear();
+                layout.symbols = &scratch;
+                if (!layout.culling
+                    || isVisible(entry.shape->getBounds(), entry.shape->getStroke(), layout))
+                    entry.shape->serialize(entry.fragment, layout);
+                if (!scratch.empty() || entry.symbols) {
+                    if (!entry.symbols)
+                        entry.symbols.reset(new SymbolTable());
+                    else
+                        entry.symbols->clear();
+                    entry.symbols->merge(scratch);
+                }
+                entry.dirty = false;
+                symbols_stale = true;
+                ++misses;
+            }
+            if (!symbols_stale)
+                return;
+            symbols.clear();
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                Entry const & entry = entries[order[i]];
+                if (entry.shape && entry.symbols)
+                    symbols.merge(*entry.symbols);
+            }
+            symbols_stale = false;
+        }
+        std::string file_name;
+        Layout layout;
+        Compression compression;
+        // Indexed by handle; removed shapes leave an empty entry whose handle
+        //  is in free_handles.  order holds the handles in drawing order,
+        //  along with those of shapes removed since it was last compacted.
+        std::vector<Entry> entries;
+        std::vector<Handle> free_handles;
+        std::vector<Handle> order;
+        bool order_stale;
+        // Definitions of all shapes, gathered from their entries.
+        SymbolTable symbols;
+        bool symbols_stale;
+        unsigned long long hits;
+        unsigned long long misses;
+    };
+
+    // Document built by a BatchRenderer job.  Shapes are serialized as they
+    //  are added, into buffers the worker thread reuses for its next job.
+    class BatchDocument
+    {
+    public:
+        // See Document::define().
+        void define(std::string const & id, Shape const & shape)
+        {
+            appendDefinition(definitions, id, shape, layout);
+        }
+        BatchDocument & operator<<(Shape const & shape)
+        {
+            if (layout.culling && !isVisible(shape.getBounds(), shape.getStroke(), layout))
+                return *this;
+            shape.serialize(body, layout);
+            return *this;
+        }
+        Layout const & getLayout() const
+        {
+            return layout;
+        }
+    private:
+        friend class BatchRenderer;
+        BatchDocument(Layout const & layout, std::string & body, std::string & definitions)
+            : layout(layout), body(body), definitions(definitions) { }
+        BatchDocument(BatchDocument const &);
+        BatchDocument & operator=(BatchDocument const &);
+
+        Layout const & layout;
+        std::string & body;
+        std::string & definitions;
+    };
+
+    // Renders many small documents on a pool of threads and writes them to
+    //  separate files or into one tar archive.  Jobs are queued with add()
+    //  and run by renderFiles() or renderArchive(), spread over a WorkerPool
+    //  the renderer keeps for its lifetime.  Each thread keeps its
+    //  serialization buffers from one job to the next, so a warmed-up thread
+    //  renders a document without allocating, apart from what the job
+    //  itself does.
+    //
+    //  batch.add("sensor-17.svg", [&](BatchDocument & doc) {
+    //      doc << Polyline(points, Fill(), Stroke(1, Color::Blue));
+    //  });
+    //  batch.renderArchive("charts.tar");
+    class BatchRenderer
+    {
+    public:
+        typedef std::function<void (BatchDocument &)> Build;
+
+        // threads = 0 uses one thread per core.
+        explicit BatchRenderer(Layout const & layout = Layout(), unsigned threads = 0)
+            : layout(layout),
+            threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+            style_sharing(false), pool(new WorkerPool(this->threads)) { }
+
+        // Queues a document named name, built by build on one of the worker
+        //  threads.  build is called once per render and must be safe to run
+        //  at the same time as the other jobs.
+        void add(std::string const & name, Build build)
+        {
+            add(name, layout, std::move(build));
+        }
+        void add(std::string const & name, Layout const & layout, Build build)
+        {
+            jobs.push_back(Job(name, layout, std::move(build)));
+        }
+        std::size_t size() const
+        {
+            return jobs.size();
+        }
+        void clear()
+        {
+            jobs.clear();
+        }
+
+        // Writes styles as classes, see Document::setStyleSharing().  Each
+        //  document gets the classes it uses, numbered in document order, so
+        //  the output does not depend on which thread ran the job or when.
+        //  The style sheet belongs to the thread and is reused for its jobs.
+        void setStyleSharing(bool enabled)
+        {
+            style_sharing = enabled;
+        }
+        // Applies to every file, or to the archive as a whole.
+        void setCompression(Compression const & compression)
+        {
+            this->compression = compression;
+        }
+
+        // Writes each document to the file directory/name, or to name if
+        //  directory is empty.  Directories are not created.  stats receives
+        //  the totals over all files.  Returns false if any file failed; the
+        //  others are still written.  An exception thrown by a Build stops
+        //  the jobs not yet started and is rethrown once the running ones
+        //  are done.
+        bool renderFiles(std::string const & directory = "", OutputStats * stats = 0)
+        {
+            std::atomic<unsigned long long> raw_bytes(0);
+            std::atomic<unsigned long long> compressed_bytes(0);
+            bool ok = run([&](Worker & worker, Job const & job) {
+                OutputStats written;
+                bool saved = writeDocumentFile(directory.empty() ? job.name
+                    : directory + '/' + job.name, compression, [&](Sink & sink) {
+                    return sink.writeChunks(worker.chunks.data(), worker.chunks.size());
+                }, written);
+                raw_bytes += written.raw_bytes;
+                compressed_bytes += written.compressed_bytes;
+                return saved;
+            });
+            if (stats) {
+                stats->raw_bytes = raw_bytes;
+                stats->compressed_bytes = compressed_bytes;
+            }
+            return ok;
+        }
+        // Writes all documents into the POSIX tar (ustar) archive file_name,
+        //  in the order they finish, with gzip compression this gives a
+        //  .tar.gz.  Names up to 255 bytes are stored if they can be split
+        //  at a '/'.  stats receives the size of the archive before and
+        //  after compression.
+        bool renderArchive(std::string const & file_name, OutputStats * stats = 0)
+        {
+            OutputStats written;
+            if (!writeDocumentFile(file_name, compression, [&](Sink & sink) {
+                std::mutex mutex;
+                bool ok = run([&](Worker & worker, Job const & job) {
+                    std::size_t size = 0;
+                    for (std::size_t i = 0; i < worker.chunks.size(); ++i)
+                        size += worker.chunks[i].size;
+                    if (!tarHeader(worker.tar_header, job.name, size))
+                        return false;
+                    static char const padding[tar_block] = { 0 };
+                    worker.chunks.insert(worker.chunks.begin(),
+                        OutputChunk(worker.tar_header, tar_block));
+                    if (size % tar_block)
+                        worker.chunks.push_back(OutputChunk(padding, tar_block - size % tar_block));
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return sink.writeChunks(worker.chunks.data(), worker.chunks.size());
+                });
+                // The archive ends with two zero blocks.
+                static char const end[2 * tar_block] = { 0 };
+                return sink.write(end, sizeof end) && ok;
+            }, written))
+                return false;
+            if (stats)
+                *stats = written;
+            return true;
+        }
+    private:
+        static std::size_t const tar_block = 512;
+
+        struct Job
+        {
+            Job(std::string const & name, Layout const & layout, Build build)
+                : name(name), layout(layout), build(std::move(build)) { }
+            std::string name;
+            Layout layout;
+            Build build;
+        };
+
+        // Buffers of one thread, reused for every job it runs.
+        struct Worker
+        {
+            Worker() { appendDocumentEnd(end); }
+
+            // Builds job and points chunks at the pieces of the document.
+            void render(Job const & job, bool style_sharing)
+            {
+                Layout layout = job.layout;
+                style_sheet.clear();
+                layout.style_sheet = style_sharing ? &style_sheet : 0;
+                layout.symbols = &symbols;
+                body.clear();
+                definitions.clear();
+                symbols.clear();
+                BatchDocument document(layout, body, definitions);
+                job.build(document);
+                symbol_text.clear();
+                symbols.serialize(symbol_text);
+
+                start.clear();
+                appendDocumentStart(start, layout);
+                chunks.clear();
+                chunks.push_back(OutputChunk(start.data(), start.size()));
+                if (!definitions.empty()) {
+                    static char const defs_start[] = "\t<defs>\n";
+                    static char const defs_end[] = "\t</defs>\n";
+                    chunks.push_back(OutputChunk(defs_start, sizeof defs_start - 1));
+                    chunks.push_back(OutputChunk(definitions.data(), definitions.size()));
+                    chunks.push_back(OutputChunk(defs_end, sizeof defs_end - 1));
+                }
+                chunks.push_back(OutputChunk(body.data(), body.size()));
+                if (!symbol_text.empty())
+                    chunks.push_back(OutputChunk(symbol_text.data(), symbol_text.size()));
+                style.clear();
+                style_sheet.serialize(style);
+                if (!style.empty())
+                    chunks.push_back(OutputChunk(style.data(), style.size()));
+                chunks.push_back(OutputChunk(end.data(), end.size()));
+            }
+
+            std::string start;
+            std::string definitions;
+            std::string body;
+            SymbolTable symbols;
+            std::string symbol_text;
+            StyleSheet style_sheet;
+            std::string style;
+            std::string end;
+            std::vector<OutputChunk> chunks;
+            char tar_header[tar_block];
+        };
+
+        // Renders every job on the worker threads and passes the result to
+        //  emit(worker, job).  Returns false if any call of emit did.
+        template <typename Emit>
+        bool run(Emit emit)
+        {
+            if (workers.size() < threads)
+                workers.resize(threads);
+            std::atomic<bool> ok(true);
+            pool->run(jobs.size(), [&](unsigned thread, std::size_t i) {
+                Worker & worker = workers[thread];
+                worker.render(jobs[i], style_sharing);
+                if (!emit(worker, jobs[i]))
+                    ok = false;
+            });
+            return ok;
+        }
+
+        // Writes value as width - 1 octal digits and a NUL, as tar does.
+        static void writeOctal(char * field, std::size_t width, unsigned long long value)
+        {
+            field[width - 1] = '\0';
+            for (std::size_t i = width - 1; i-- > 0; value >>= 3)
+                field[i] = static_cast<char>('0' + (value & 7));
+        }
+        // Fills block with the ustar header of a regular file.  Returns false
+        //  if the name or size does not fit.
+        static bool tarHeader(char * block, std::string const & name, unsigned long long size)
+        {
+            std::fill(block, block + tar_block, '\0');
+            // Longer names are split at a '/' into a prefix of up to 155
+            //  bytes and a name of up to 100.
+            std::size_t split = 0;
+            if (name.size() > 100) {
+                split = name.find('/', name.size() - 101);
+                if (split == std::string::npos || split > 155)
+                    return false;
+                std::copy(name.begin(), name.begin() + split, block + 345);
+                ++split;
+            }
+            if (name.size() == split || size >= 1ull << 33)
+                return false;
+            std::copy(name.begin() + split, name.end(), block);
+
+            writeOctal(block + 100, 8, 0644);
+            writeOctal(block + 108, 8, 0);
+            writeOctal(block + 116, 8, 0);
+            writeOctal(block + 124, 12, size);
+            // A fixed modification time keeps archives of the same documents
+            //  byte for byte the same.
+            writeOctal(block + 136, 12, 0);
+            block[156] = '0';
+            std::copy("ustar", "ustar" + 6, block + 257);
+            block[263] = block[264] = '0';
+
+            // The checksum is taken with its own field set to spaces.
+            std::fill(block + 148, block + 156, ' ');
+            unsigned long long checksum = 0;
+            for (std::size_t i = 0; i < tar_block; ++i)
+                checksum += static_cast<unsigned char>(block[i]);
+            writeOctal(block + 148, 7, checksum);
+            return true;
+        }
+
         Layout layout;
+        unsigned threads;
+        bool style_sharing;
+        Compression compression;
+        std::vector<Job> jobs;
+        std::vector<Worker> workers;
+        std::unique_ptr<WorkerPool> pool;
+    };
+
+    // Level of detail of the tiles written by TileExporter.  Sizes are in
+    //  pixels of the level being written, so the coarser the level, the
+    //  more is left out.  The deepest level shows the scene at full scale
+    //  and keeps every shape; only quantum applies to it.
+    struct LevelOfDetail
+    {
+        LevelOfDetail(double min_size = 0.5, double quantum = 0)
+            : min_size(min_size), quantum(quantum) { }
+        static LevelOfDetail full() { return LevelOfDetail(0, 0); }
+
+        // Shapes whose box is smaller than this in both directions are left
+        //  out of all levels but the deepest.  Shapes of unknown extent are
+        //  always kept.
+        double min_size;
+        // If positive, the points of polylines, polygons and paths are
+        //  snapped to a grid of this size and written with
+        //  PointEncoding::Compact, which leaves out points that snap onto
+        //  the one before.
+        double quantum;
+    };
+
+    // Writes a scene too large for a single file as a pyramid of square SVG
+    //  tiles, for viewers that load only the tiles in view.  The deepest
+    //  level shows the scene at the scale of the layout, and each level
+    //  above it halves the scale, up to level 0, which fits in one tile.
+    //  A tile holds only the shapes that meet it, found through a GridIndex,
+    //  with polylines and paths cut down to the tile as with Layout::culling
+    //  and shapes reduced as set by LevelOfDetail.  Tiles are rendered in
+    //  parallel with workStealingFor().
+    class TileExporter
+    {
+    public:
+        // threads = 0 uses one thread per core.
+        explicit TileExporter(Layout const & layout, unsigned tile_size = 256, unsigned threads = 0)
+            : layout(layout), tile_size(tile_size ? tile_size : 256),
+            threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+            level_count(0), max_margin(0), max_non_scaling_margin(0) { }
+
+        // Shapes are kept through cloneShape().
+        TileExporter & operator<<(Shape const & shape)
+        {
+            std::unique_ptr<Shape> copy(cloneShape(shape));
+            addMargin(copy->getStroke());
+            if (dynamic_cast<Use const *>(copy.get()))
+                uses.push_back(shapes.size());
+            bounds.push_back(copy->getBounds());
+            shapes.push_back(std::move(copy));
+            return *this;
+        }
+        // Adds shape to the <defs> of every tile, see Document::define().
+        //  A Use of id is placed in the tiles that the definition meets.
+        void define(std::string const & id, Shape const & shape)
+        {
+            definitions.push_back(std::make_pair(id, std::unique_ptr<Shape>(cloneShape(shape))));
+            addMargin(shape.getStroke());
+        }
+        void setLevelOfDetail(LevelOfDetail const & detail)
+        {
+            this->detail = detail;
+        }
+        // 0, the default, adds levels until level 0 fits in one tile.
+        void setLevelCount(unsigned count)
+        {
+            level_count = count;
+        }
+        unsigned levelCount() const
+        {
+            if (level_count)
+                return level_count;
+            double size = std::max(layout.dimensions.width, layout.dimensions.height);
+            unsigned count = 1;
+            while (size > tile_size && count < 31) {
+                size /= 2;
+                ++count;
+            }
+            return count;
+        }
+        // Applies to every tile.
+        void setCompression(Compression const & compression)
+        {
+            this->compression = compression;
+        }
+
+        // Writes each tile that holds shapes to directory/L_C_R.svg for
+        //  level L, column C and row R counted from the top left, or .svgz
+        //  with gzip compression, and an index of the levels and tiles to
+        //  directory/index.json.  The directory must exist.  stats receives
+        //  the totals over all tiles.  Returns false if any file failed.
+        bool save(std::string const & directory, OutputStats * stats = 0)
+        {
+            for (std::size_t i = 0; i < uses.size(); ++i)
+                bounds[uses[i]] = useBounds(static_cast<Use const &>(*shapes[uses[i]]));
+            index.build(bounds, shapes.size());
+            std::vector<Level> levels(levelCount());
+            std::vector<Tile> tiles;
+            for (unsigned z = 0; z < levels.size(); ++z) {
+                Level & level = levels[z];
+                double factor = std::ldexp(1.0,
+                    static_cast<int>(z) + 1 - static_cast<int>(levels.size()));
+                level.scale = layout.scale * factor;
+                level.min_size = z + 1 < levels.size() ? detail.min_size / level.scale : 0;
+                level.width = layout.dimensions.width * factor;
+                level.height = layout.dimensions.height * factor;
+                level.columns = std::max<std::size_t>(1,
+                    static_cast<std::size_t>(std::ceil(level.width / tile_size)));
+                level.rows = std::max<std::size_t>(1,
+                    static_cast<std::size_t>(std::ceil(level.height / tile_size)));
+                level.first_tile = tiles.size();
+                for (std::size_t row = 0; row < level.rows; ++row)
+                    for (std::size_t column = 0; column < level.columns; ++column)
+                        tiles.push_back(Tile(z, column, row));
+
+                Layout level_layout = layout;
+                level_layout.scale = level.scale;
+                for (std::size_t i = 0; i < definitions.size(); ++i)
+                    appendDefinition(level.definitions, definitions[i].first,
+                        *definitions[i].second, level_layout);
+            }
+
+            std::string const extension =
+                compression.format == Compression::Gzip ? ".svgz" : ".svg";
+            std::vector<Worker> workers(threads);
+            std::atomic<unsigned long long> raw_bytes(0);
+            std::atomic<unsigned long long> compressed_bytes(0);
+            std::atomic<bool> ok(true);
+            workStealingFor(tiles.size(), threads, [&](unsigned thread, std::size_t i) {
+                Tile & tile = tiles[i];
+                Worker & worker = workers[thread];
+                Level const & level = levels[tile.level];
+                Layout tile_layout = tileLayout(level, tile.column, tile.row);
+                tile.shapes = render(worker, level, tile_layout);
+                if (!tile.shapes)
+                    return;
+
+                std::string & name = tile.file;
+                appendNumber(name, static_cast<int>(tile.level));
+                name += '_';
+                appendNumber(name, static_cast<int>(tile.column));
+                name += '_';
+                appendNumber(name, static_cast<int>(tile.row));
+                name += extension;
+                OutputStats written;
+                if (!writeDocumentFile(directory + '/' + name, compression, [&](Sink & sink) {
+                    return sink.writeChunks(worker.chunks.data(), worker.chunks.size());
+                }, written))
+                    ok = false;
+                raw_bytes += written.raw_bytes;
+                compressed_bytes += written.compressed_bytes;
+            });
+            if (stats) {
+                stats->raw_bytes = raw_bytes;
+                stats->compressed_bytes = compressed_bytes;
+            }
+
+            std::string json = indexJson(levels, tiles);
+            OutputStats written;
+            if (!writeDocumentFile(directory + "/index.json", Compression(), [&](Sink & sink) {
+                return sink.write(json.data(), json.size());
+            }, written))
+                return false;
+            return ok;
+        }
+    private:
+        struct Level
+        {
+            Level() : scale(1), min_size(0), width(0), height(0), columns(1), rows(1),
+                first_tile(0) { }
+            double scale;
+            // LevelOfDetail::min_size in user units, 0 at the deepest level.
+            double min_size;
+            // Size of the whole level in pixels.
+            double width;
+            double height;
+            std::size_t columns;
+            std::size_t rows;
+            std::size_t first_tile;
+            std::string definitions;
+        };
+        struct Tile
+        {
+            Tile(unsigned level, std::size_t column, std::size_t row)
+                : level(level), column(column), row(row), shapes(0) { }
+            unsigned level;
+            std::size_t column;
+            std::size_t row;
+            // Shapes written to the tile, none if it was left out.
+            std::size_t shapes;
+            std::string file;
+        };
+        // Buffers of one thread, reused for every tile it renders.
+        struct Worker
+        {
+            Worker() { appendDocumentEnd(end); }
+            std::string start;
+            std::string body;
+            SymbolTable symbols;
+            std::string symbol_text;
+            std::string end;
+            std::vector<std::size_t> candidates;
+            std::vector<OutputChunk> chunks;
+        };
+
+        void addMargin(Stroke const & stroke)
+        {
+            double margin = strokeReach(stroke);
+            double & max = stroke.isNonScaling() ? max_non_scaling_margin : max_margin;
+            if (margin > max)
+                max = margin;
+        }
+        // The bounds of the definition use refers to, moved to its position.
+        //  Definitions are written with y pointing down, see
+        //  definitionLayout(), so they are mirrored along the axes the layout
+        //  flips.  Empty if the definition is unknown or has no bounds.
+        Bounds useBounds(Use const & use) const
+        {
+            Bounds definition;
+            for (std::size_t i = definitions.size(); i-- > 0; )
+                if (definitions[i].first == use.getId()) {
+                    definition = definitions[i].second->getBounds();
+                    break;
+                }
+            if (definition.empty)
+                return definition;
+            Point const & at = use.getPosition();
+            bool flip_x = layout.origin == Layout::BottomRight || layout.origin == Layout::TopRight;
+            bool flip_y = layout.origin == Layout::BottomLeft || layout.origin == Layout::BottomRight;
+            return Bounds(Point(flip_x ? at.x - definition.max.x : at.x + definition.min.x,
+                flip_y ? at.y - definition.max.y : at.y + definition.min.y),
+                Point(flip_x ? at.x - definition.min.x : at.x + definition.max.x,
+                flip_y ? at.y - definition.min.y : at.y + definition.max.y));
+        }
+        // The layout that maps the tile at column and row of level onto a
+        //  canvas of its own: like the layout of the level, with the origin
+        //  offset moved by the position of the tile.  Tiles on the right and
+        //  bottom edges are cut to the size of the level.
+        Layout tileLayout(Level const & level, std::size_t column, std::size_t row) const
+        {
+            double left = static_cast<double>(column) * tile_size;
+            double top = static_cast<double>(row) * tile_size;
+            Layout tile = layout;
+            tile.scale = level.scale;
+            tile.dimensions = Dimensions(std::min<double>(tile_size, level.width - left),
+                std::min<double>(tile_size, level.height - top));
+            if (layout.origin == Layout::BottomRight || layout.origin == Layout::TopRight)
+                tile.origin_offset.x += (tile.dimensions.width + left - level.width) / level.scale;
+            else
+                tile.origin_offset.x -= left / level.scale;
+            if (layout.origin == Layout::BottomLeft || layout.origin == Layout::BottomRight)
+                tile.origin_offset.y += (tile.dimensions.height + top - level.height) / level.scale;
+            else
+                tile.origin_offset.y -= top / level.scale;
+            tile.culling = true;
+            if (detail.quantum > 0)
+                tile.point_encoding = PointEncoding::compact(detail.quantum);
+            return tile;
+        }
+        // Renders the shapes of a tile into the buffers of worker and points
+        //  worker.chunks at the pieces of the document.  Returns the number
+        //  of shapes written.
+        std::size_t render(Worker & worker, Level const & level, Layout const & tile_layout) const
+        {
+            Bounds area = visibleArea(tile_layout,
+                max_margin + max_non_scaling_margin / tile_layout.scale);
+            worker.candidates.clear();
+            index.query(area, worker.candidates);
+            double const min_size = level.min_size;
+            Layout layout = tile_layout;
+            layout.symbols = &worker.symbols;
+
+            worker.body.clear();
+            worker.symbols.clear();
+            std::size_t written = 0;
+            for (std::size_t i = 0; i < worker.candidates.size(); ++i) {
+                std::size_t item = worker.candidates[i];
+                Bounds const & box = bounds[item];
+                if (!box.empty && (!box.intersects(area) || (box.max.x - box.min.x < min_size
+                    && box.max.y - box.min.y < min_size)))
+                    continue;
+                shapes[item]->serialize(worker.body, layout);
+                ++written;
+            }
+            if (!written)
+                return 0;
+            worker.symbol_text.clear();
+            worker.symbols.serialize(worker.symbol_text);
+
+            worker.start.clear();
+            appendDocumentStart(worker.start, tile_layout);
+            worker.chunks.clear();
+            worker.chunks.push_back(OutputChunk(worker.start.data(), worker.start.size()));
+            if (!level.definitions.empty()) {
+                static char const defs_start[] = "\t<defs>\n";
+                static char const defs_end[] = "\t</defs>\n";
+                worker.chunks.push_back(OutputChunk(defs_start, sizeof defs_start - 1));
+                worker.chunks.push_back(OutputChunk(level.definitions.data(),
+                    level.definitions.size()));
+                worker.chunks.push_back(OutputChunk(defs_end, sizeof defs_end - 1));
+            }
+            worker.chunks.push_back(OutputChunk(worker.body.data(), worker.body.size()));
+            if (!worker.symbol_text.empty())
+                worker.chunks.push_back(OutputChunk(worker.symbol_text.data(),
+                    worker.symbol_text.size()));
+            worker.chunks.push_back(OutputChunk(worker.end.data(), worker.end.size()));
+            return written;
+        }
+        std::string indexJson(std::vector<Level> const & levels,
+            std::vector<Tile> const & tiles) const
+        {
+            std::string json = "{\n  \"tile_size\": ";
+            appendNumber(json, static_cast<int>(tile_size));
+            json += ",\n  \"levels\": [";
+            for (std::size_t z = 0; z < levels.size(); ++z) {
+                Level const & level = levels[z];
+                json += z ? ",\n    {" : "\n    {";
+                json += "\"level\": ";
+                appendNumber(json, static_cast<int>(z));
+                json += ", \"scale\": ";
+                appendNumber(json, level.scale, NumberFormat::shortest());
+                json += ", \"width\": ";
+                appendNumber(json, level.width, NumberFormat::shortest());
+                json += ", \"height\": ";
+                appendNumber(json, level.height, NumberFormat::shortest());
+                json += ", \"columns\": ";
+                appendNumber(json, static_cast<int>(level.columns));
+                json += ", \"rows\": ";
+                appendNumber(json, static_cast<int>(level.rows));
+                json += ", \"tiles\": [";
+                bool first = true;
+                for (std::size_t i = level.first_tile;
+                    i < level.first_tile + level.columns * level.rows; ++i) {
+                    if (!tiles[i].shapes)
+                        continue;
+                    json += first ? "\n      {" : ",\n      {";
+                    first = false;
+                    json += "\"column\": ";
+                    appendNumber(json, static_cast<int>(tiles[i].column));
+                    json += ", \"row\": ";
+                    appendNumber(json, static_cast<int>(tiles[i].row));
+                    json += ", \"file\": \"";
+                    json += tiles[i].file;
+                    json += "\", \"shapes\": ";
+                    appendNumber(json, static_cast<int>(tiles[i].shapes));
+                    json += '}';
+                }
+                json += first ? "]}" : "\n    ]}";
+            }
+            json += "\n  ]\n}\n";
+            return json;
+        }
 
-        std::vector<std::string> body_nodes_str_list;
+        Layout layout;
+        unsigned tile_size;
+        unsigned threads;
+        unsigned level_count;
+        LevelOfDetail detail;
+        Compression compression;
+        std::vector<std::unique_ptr<Shape> > shapes;
+        std::vector<Bounds> bounds;
+        // Positions in shapes of the Use shapes, whose bounds save() fills in.
+        std::vector<std::size_t> uses;
+        std::vector<std::pair<std::string, std::unique_ptr<Shape> > > definitions;
+        GridIndex index;
+        // Largest stroke margins, to find shapes whose stroke reaches into a
+        //  tile; see RetainedDocument.
+        double max_margin;
+        double max_non_scaling_margin;
     };
 }
 
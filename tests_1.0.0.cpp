@@ -0,0 +1,1415 @@
+
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include "simple_svg_1.0.0.hpp"
+
+#include <algorithm>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace svg;
+
+// Behaviour tests for the Simple SVG library.  Files are written to the
+//  working directory.  Prints the failed checks and exits with 1 if any
+//  failed.
+//
+//  Usage: simple_svg_tests
+
+namespace
+{
+    int failures = 0;
+
+    // Unlike assert(), stays active in release builds.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #condition "\n"; \
+            ++failures; \
+        } \
+    } while (false)
+
+    // Serializes shape alone, without shared styles.
+    std::string fragment(Shape const & shape, Layout const & layout)
+    {
+        std::string out;
+        shape.serialize(out, layout);
+        return out;
+    }
+
+    std::string readFile(std::string const & file_name)
+    {
+        std::ifstream in(file_name.c_str(), std::ios::in | std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::size_t countOf(std::string const & text, char const * needle)
+    {
+        std::size_t count = 0;
+        for (std::size_t at = 0; (at = text.find(needle, at)) != std::string::npos; ++at)
+            ++count;
+        return count;
+    }
+
+    void addSampleShapes(std::vector<std::unique_ptr<Shape> > & shapes)
+    {
+        shapes.emplace_back(new Circle(Point(10.5, 20.25), 6, Fill(Color::Blue),
+            Stroke(1.5, Color::Black)));
+        shapes.emplace_back(new Elipse(Point(30, 40), 10, 6, Fill(Color(1, 2, 3))));
+        shapes.emplace_back(new Rectangle(Point(50, 60), 20, 10, Fill(Color::Green),
+            Stroke(2, Color::Red, true)));
+        shapes.emplace_back(new Line(Point(1, 2), Point(300, 250), Stroke(1, Color::Purple)));
+        Polyline * polyline = new Polyline(Fill(), Stroke(1, Color::Blue));
+        for (int i = 0; i < 50; ++i)
+            *polyline << Point(i * 3.7, 100 + std::sin(i * 0.3) * 40);
+        shapes.emplace_back(polyline);
+        Polygon * polygon = new Polygon(Fill(Color::Yellow), Stroke(1, Color::Black));
+        *polygon << Point(0, 0) << Point(10, 30) << Point(40, 5);
+        shapes.emplace_back(polygon);
+        Path * path = new Path(Fill(Color::Orange), Stroke(0.5, Color::Black));
+        *path << Point(10, 10) << Point(20, 10) << Point(20, 30);
+        path->startNewSubPath();
+        *path << Point(100, 100) << Point(110, 120) << Point(105, 130);
+        shapes.emplace_back(path);
+        shapes.emplace_back(new Text(Point(5, 5), "a < b & \"c\" > d", Fill(Color::Black),
+            Font(10, "Fam \"X\" & Y; } {")));
+    }
+
+    // Reads back the shapes of file_name, skipping <defs>.
+    std::vector<std::unique_ptr<Shape> > readShapes(std::string const & file_name,
+        Layout const & layout)
+    {
+        std::vector<std::unique_ptr<Shape> > shapes;
+        SvgFileReader file(file_name);
+        SvgReader reader = file.reader();
+        SvgElement element;
+        while (reader.next(element)) {
+            if (element.is("defs")) {
+                while (reader.next(element)
+                    && !(element.kind == SvgElement::End && element.is("defs"))) { }
+                continue;
+            }
+            std::unique_ptr<Shape> shape = file.readShape(element, reader, layout);
+            if (shape)
+                shapes.push_back(std::move(shape));
+        }
+        return shapes;
+    }
+
+    bool readsBack(std::string const & text, double expected)
+    {
+        char const * p = text.data();
+        double value;
+        return readNumber(p, p + text.size(), value) && value == expected
+            && p == text.data() + text.size();
+    }
+
+    // A shape written against the toString() interface of version 1.0.0.
+    class Label : public Shape
+    {
+    public:
+        explicit Label(std::string const & text) : text(text) { }
+        std::string toString(Layout const &) const
+        {
+            return "\t<!-- " + text + " -->\n";
+        }
+        void offset(Point const &) { }
+    private:
+        std::string text;
+    };
+
+    class Blank : public Serializeable
+    {
+    };
+
+    // Subclasses may override either serialize() or toString(); one that
+    //  overrides neither fails with an exception instead of a stack overflow.
+    void serializeableTests()
+    {
+        Layout layout(Dimensions(100, 100));
+        Label label("legacy");
+        CHECK(label.toString(layout) == "\t<!-- legacy -->\n");
+        std::string out = "head ";
+        label.serialize(out, layout);
+        CHECK(out == "head \t<!-- legacy -->\n");
+
+        Document document("tests_serializeable.svg", layout);
+        document << label << Circle(Point(10, 10), 4, Fill(Color::Red));
+        std::string const svg = document.toString();
+        CHECK(svg.find("\t<!-- legacy -->\n\t<circle") != std::string::npos);
+
+        Circle circle(Point(10, 10), 4, Fill(Color::Red));
+        std::string serialized;
+        circle.serialize(serialized, layout);
+        CHECK(circle.toString(layout) == serialized);
+
+        Blank blank;
+        bool threw = false;
+        try {
+            blank.toString(layout);
+        }
+        catch (std::logic_error const &) {
+            threw = true;
+        }
+        CHECK(threw);
+        // The guard is reset after the exception.
+        CHECK(label.toString(layout) == "\t<!-- legacy -->\n");
+        threw = false;
+        try {
+            std::string text;
+            blank.serialize(text, layout);
+        }
+        catch (std::logic_error const &) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+
+    std::string formatted(double value, NumberFormat const & format = NumberFormat())
+    {
+        std::string out;
+        appendNumber(out, value, format);
+        return out;
+    }
+
+    // The default format writes what "%g" writes; Fixed rounds to the given
+    //  decimals without trailing zeros, and neither depends on the locale.
+    void numberFormatTests()
+    {
+        std::mt19937_64 random(2);
+        std::uniform_real_distribution<double> coordinate(-1e4, 1e4);
+        std::uniform_int_distribution<int> exponent(-8, 9);
+        int mismatches = 0;
+        for (int i = 0; i < 100000; ++i) {
+            double value = coordinate(random) * std::pow(10.0, exponent(random));
+            if (i % 3 == 0)
+                value = std::floor(value * 100) / 100;
+            char expected[32];
+            std::snprintf(expected, sizeof expected, "%g", value);
+            mismatches += formatted(value) != expected;
+        }
+        CHECK(mismatches == 0);
+        CHECK(formatted(0) == "0");
+        CHECK(formatted(-0.000012345678) == "-1.23457e-05");
+        CHECK(formatted(1234567) == "1.23457e+06");
+
+        CHECK(formatted(1.005, NumberFormat::fixed(2)) == "1");
+        CHECK(formatted(2.5, NumberFormat::fixed(0)) == "3");
+        CHECK(formatted(-0.125, NumberFormat::fixed(2)) == "-0.13");
+        CHECK(formatted(12.5, NumberFormat::fixed(3)) == "12.5");
+        CHECK(formatted(-0.001, NumberFormat::fixed(2)) == "0");
+        CHECK(formatted(0.1, NumberFormat::shortest()) == "0.1");
+        CHECK(formatted(1.0 / 3, NumberFormat::shortest()) == "0.3333333333333333");
+
+        char const * locales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "C.UTF-8" };
+        std::string const before = std::setlocale(LC_NUMERIC, 0);
+        for (std::size_t i = 0; i < sizeof locales / sizeof *locales; ++i) {
+            if (!std::setlocale(LC_NUMERIC, locales[i]))
+                continue;
+            CHECK(formatted(1.5) == "1.5");
+            CHECK(formatted(1.5e-7) == "1.5e-07");
+            CHECK(formatted(0.1, NumberFormat::shortest()) == "0.1");
+        }
+        std::setlocale(LC_NUMERIC, before.c_str());
+    }
+
+    // A streamed document is written as it is built, in chunks of about the
+    //  buffer size, and ends up the same as the Document built alike.
+    void streamingTests()
+    {
+        Layout layout(Dimensions(200, 300), Layout::TopLeft);
+        Document document("tests_streaming.svg", layout);
+        std::ostringstream stream;
+        {
+            StreamingDocument streaming(stream, layout, Compression(), 64);
+            std::vector<std::unique_ptr<Shape> > shapes;
+            addSampleShapes(shapes);
+            for (std::size_t i = 0; i < shapes.size(); ++i) {
+                document << *shapes[i];
+                streaming << *shapes[i];
+                // Everything but the last, partly filled buffer is out.
+                CHECK(stream.str().size() + 64 + 1024 > document.toString().size());
+            }
+            CHECK(streaming.close());
+            CHECK(streaming.good());
+            CHECK(streaming.stats().raw_bytes == stream.str().size());
+            CHECK(streaming.stats().compressed_bytes == stream.str().size());
+            // Closing again and adding afterwards do nothing.
+            CHECK(streaming.close());
+            streaming << Circle(Point(1, 1), 1, Fill(Color::Red));
+        }
+        CHECK(stream.str() == document.toString());
+
+        // Style sharing and culling work as in Document.
+        layout.culling = true;
+        Document shared("tests_streaming_shared.svg", layout);
+        shared.setStyleSharing(true);
+        std::ostringstream shared_stream;
+        StreamingDocument streaming(shared_stream, layout);
+        streaming.setStyleSharing(true);
+        streaming.setCulling(true);
+        for (int i = 0; i < 10; ++i) {
+            Circle circle(Point(i * 30.0, 10), 4, Fill(Color::Red));
+            shared << circle;
+            streaming << circle;
+        }
+        streaming.close();
+        std::string const svg = shared_stream.str();
+        CHECK(countOf(svg, "<circle") == 7);
+        CHECK(countOf(svg, "class=\"s0\"") == 7);
+        CHECK(countOf(svg, "<style") == 1);
+        CHECK(countOf(shared.toString(), "<circle") == 7);
+    }
+
+    // Reads a gzip file back with zlib, or returns "" if it is not one.
+    std::string gunzip(std::string const & file_name)
+    {
+        std::string out;
+#ifdef SIMPLE_SVG_USE_ZLIB
+        gzFile file = gzopen(file_name.c_str(), "rb");
+        if (!file)
+            return out;
+        char buffer[4096];
+        int length;
+        while ((length = gzread(file, buffer, sizeof buffer)) > 0)
+            out.append(buffer, length);
+        gzclose(file);
+#else
+        (void)file_name;
+#endif
+        return out;
+    }
+
+    // Compressed output decompresses to the uncompressed document, from
+    //  Document and StreamingDocument alike.
+    void compressionTests()
+    {
+        if (!compressionAvailable(Compression::gzip()))
+            return;
+        Layout layout(Dimensions(200, 300));
+        Document document("tests_compressed.svgz", layout);
+        std::vector<std::unique_ptr<Shape> > shapes;
+        addSampleShapes(shapes);
+        for (int copy = 0; copy < 20; ++copy)
+            for (std::size_t i = 0; i < shapes.size(); ++i)
+                document << *shapes[i];
+        document.setCompression(Compression::gzip(9));
+        OutputStats stats;
+        CHECK(document.save(&stats));
+        std::string const svg = document.toString();
+        std::string const file = readFile("tests_compressed.svgz");
+        CHECK(file.size() > 2 && file[0] == '\x1f' && file[1] == '\x8b');
+        CHECK(gunzip("tests_compressed.svgz") == svg);
+        CHECK(stats.raw_bytes == svg.size());
+        CHECK(stats.compressed_bytes == file.size());
+        CHECK(stats.compressed_bytes < stats.raw_bytes / 4);
+
+        {
+            StreamingDocument streaming("tests_streaming.svgz", layout, Compression::gzip(),
+                256);
+            for (int copy = 0; copy < 20; ++copy)
+                for (std::size_t i = 0; i < shapes.size(); ++i)
+                    streaming << *shapes[i];
+            CHECK(streaming.close());
+            CHECK(streaming.stats().compressed_bytes == readFile("tests_streaming.svgz").size());
+        }
+        CHECK(gunzip("tests_streaming.svgz") == svg);
+    }
+
+    // Parallel serialization writes exactly what the serial path writes,
+    //  also across rounds, with shapes that cannot be cloned in between and
+    //  with style sharing switched on halfway.
+    void parallelTests()
+    {
+        Layout layout(Dimensions(400, 300), Layout::TopLeft);
+        Document serial("tests_serial.svg", layout);
+        Document parallel("tests_parallel.svg", layout);
+        parallel.setParallelSerialization(4);
+        std::vector<std::unique_ptr<Shape> > shapes;
+        addSampleShapes(shapes);
+        for (int round = 0; round < 3000; ++round) {
+            if (round == 2000) {
+                serial.setStyleSharing(true);
+                parallel.setStyleSharing(true);
+            }
+            for (std::size_t i = 0; i < shapes.size(); ++i) {
+                shapes[i]->offset(Point(0.5, 0.25));
+                serial << *shapes[i];
+                parallel << *shapes[i];
+            }
+            if (round % 500 == 0) {
+                Label label("round");
+                serial << label;
+                parallel << label;
+            }
+        }
+        std::string const svg = serial.toString();
+        CHECK(parallel.toString() == svg);
+        CHECK(countOf(svg, "<!-- round -->") == 6);
+
+        // Copies keep their own output and layout.
+        Document copy(parallel);
+        CHECK(copy.toString() == svg);
+        parallel.setParallelSerialization(1);
+        parallel << Circle(Point(1, 1), 1, Fill(Color::Red));
+        CHECK(copy.toString() == svg);
+        CHECK(parallel.toString() != svg);
+    }
+
+    // Bounds follow points edited in place, so culling never drops a
+    //  polyline that was moved onto the canvas through `points`.
+    void polylineBoundsTests()
+    {
+        Polyline polyline(Stroke(1, Color::Blue));
+        polyline << Point(-50, -50) << Point(-40, -40);
+        Bounds bounds = polyline.getBounds();
+        CHECK(bounds.min.x == -50 && bounds.max.y == -40);
+
+        polyline.points[1] = Point(60, 70);
+        bounds = polyline.getBounds();
+        CHECK(bounds.max.x == 60 && bounds.max.y == 70);
+
+        Layout layout(Dimensions(100, 100), Layout::TopLeft);
+        layout.culling = true;
+        Document document("tests_polyline_bounds.svg", layout);
+        document << polyline;
+        CHECK(document.toString().find("<polyline") != std::string::npos);
+
+        polyline.points.push_back(Point(500, 500));
+        polyline.offset(Point(1000, 0));
+        bounds = polyline.getBounds();
+        CHECK(bounds.min.x == 950 && bounds.max.x == 1500);
+    }
+
+    void decimationTests()
+    {
+        std::vector<Point> points;
+        for (int i = 0; i < 1000; ++i)
+            points.push_back(Point(i * 0.1, i == 500 ? 1000 : std::sin(i * 0.01)));
+        Layout layout(Dimensions(100, 100));
+
+        std::vector<std::size_t> kept;
+        decimate(points.data(), points.size(), layout, Decimation(), kept);
+        CHECK(kept.size() == points.size());
+
+        // At most first, lowest, highest and last of each one-pixel column,
+        //  and the spike survives.
+        kept.clear();
+        decimate(points.data(), points.size(), layout, Decimation::minMax(1), kept);
+        CHECK(kept.size() <= 4 * 101);
+        CHECK(!kept.empty() && kept.front() == 0 && kept.back() == points.size() - 1);
+        CHECK(std::find(kept.begin(), kept.end(), 500u) != kept.end());
+        CHECK(std::is_sorted(kept.begin(), kept.end()));
+
+        // One point per ten pixels, plus the ends.
+        kept.clear();
+        decimate(points.data(), points.size(), layout, Decimation::largestTriangle(10), kept);
+        CHECK(kept.size() <= 12);
+        CHECK(!kept.empty() && kept.front() == 0 && kept.back() == points.size() - 1);
+        CHECK(std::find(kept.begin(), kept.end(), 500u) != kept.end());
+        CHECK(std::is_sorted(kept.begin(), kept.end()));
+    }
+
+    LineChart sampleChart(double height, Decimation const & decimation = Decimation())
+    {
+        LineChart chart(Dimensions(5, 5));
+        chart.setVertexSymbol("dot");
+        Polyline polyline(Fill(), Stroke(1, Color::Blue));
+        for (int i = 0; i < 200; ++i)
+            polyline << Point(i * 0.25, i % 2 ? height : 0);
+        polyline.setDecimation(decimation);
+        chart << polyline;
+        return chart;
+    }
+
+    // Definitions are written once per document and placed with <use>; the
+    //  vertex markers of charts of different sizes get their own symbols,
+    //  and a decimated series gets a marker per point it keeps.
+    void instancingTests()
+    {
+        Layout layout(Dimensions(200, 400), Layout::TopLeft);
+        Document document("tests_instancing.svg", layout);
+        document.define("box", Rectangle(Point(0, 0), 4, 4, Fill(Color::Red)));
+        document << Use("box", Point(10, 10)) << Use("box", Point(20, 10));
+        document << sampleChart(30) << sampleChart(30) << sampleChart(300);
+        std::string const svg = document.toString();
+        CHECK(countOf(svg, "id=\"box\"") == 1);
+        CHECK(countOf(svg, "xlink:href=\"#box\"") == 2);
+        CHECK(countOf(svg, "id=\"dot-1\"") == 1);
+        CHECK(countOf(svg, "id=\"dot-10\"") == 1);
+        CHECK(countOf(svg, "xlink:href=\"#dot-1\"") == 400);
+        CHECK(countOf(svg, "xlink:href=\"#dot-10\"") == 200);
+        CHECK(svg.find("r=\"0.5\"") != std::string::npos);
+        CHECK(svg.find("r=\"5\"") != std::string::npos);
+
+        std::string out;
+        sampleChart(30, Decimation::minMax(10)).serialize(out, layout);
+        std::size_t line = out.find("points=\"") + 8;
+        std::size_t points = countOf(out.substr(line, out.find('"', line) - line), ",");
+        CHECK(points < 200);
+        CHECK(countOf(out, "<use") == points);
+    }
+
+    // Statistics count the elements, bytes and points a document writes and
+    //  its saves; without SIMPLE_SVG_STATS there is nothing to check.
+    void statsTests()
+    {
+#ifdef SIMPLE_SVG_STATS
+        SerializationStats stats;
+        Layout layout(Dimensions(200, 300));
+        Document document("tests_stats.svg", layout);
+        document.setStats(&stats);
+        std::string body;
+        for (int i = 0; i < 10; ++i) {
+            Circle circle(Point(i, i), 2, Fill(Color::Red));
+            document << circle;
+            circle.serialize(body, layout);
+        }
+        Polyline polyline(Stroke(1, Color::Blue));
+        for (int i = 0; i < 100; ++i)
+            polyline << Point(i, i % 7);
+        document << polyline;
+        polyline.setDecimation(Decimation::minMax(10));
+        document << polyline;
+        CHECK(document.save());
+
+        SerializationStats::Entry circles = stats.element("circle");
+        CHECK(circles.count == 10);
+        CHECK(circles.bytes == body.size());
+        CHECK(circles.points == 0);
+        SerializationStats::Entry polylines = stats.element("polyline");
+        CHECK(polylines.count == 2);
+        CHECK(polylines.points > 100 && polylines.points < 200);
+        CHECK(stats.element("text").count == 0);
+        CHECK(stats.saveCount() == 1);
+        CHECK(stats.saveBytes() == readFile("tests_stats.svg").size());
+        std::string const json = stats.toJson();
+        CHECK(json.find("\"circle\": {\"count\": 10,") != std::string::npos);
+        CHECK(json.find("\"save\": {\"count\": 1,") != std::string::npos);
+
+        // Shapes added after detaching are not counted.
+        document.setStats(0);
+        document << Circle(Point(1, 1), 2, Fill(Color::Red));
+        document.toString();
+        CHECK(stats.element("circle").count == 10);
+        stats.reset();
+        CHECK(stats.elements().empty() && stats.saveCount() == 0);
+#endif
+    }
+
+    // A subclass of a built-in shape that writes something else.
+    class Marker : public Circle
+    {
+    public:
+        explicit Marker(Point const & center) : Circle(center, 4, Fill(Color::Red)) { }
+        void serialize(std::string & out, Layout const & layout) const
+        {
+            out += "\t<!-- marker -->\n";
+            Circle::serialize(out, layout);
+        }
+        Shape * clone() const
+        {
+            return new Marker(*this);
+        }
+    };
+
+    // Adds one of each built-in shape, through the typed overloads of
+    //  RetainedDocument.
+    template <typename D>
+    void addTypedShapes(D & document)
+    {
+        document << Circle(Point(10.5, 20.25), 6, Fill(Color::Blue), Stroke(1.5, Color::Black));
+        document << Elipse(Point(30, 40), 10, 6, Fill(Color(1, 2, 3)));
+        document << Rectangle(Point(50, 60), 20, 10, Fill(Color::Green),
+            Stroke(2, Color::Red, true));
+        document << Line(Point(1, 2), Point(300, 250), Stroke(1, Color::Purple));
+        Polyline polyline(Fill(), Stroke(1, Color::Blue));
+        for (int i = 0; i < 50; ++i)
+            polyline << Point(i * 3.7, 100 + std::sin(i * 0.3) * 40);
+        document << polyline;
+        Polygon polygon(Fill(Color::Yellow), Stroke(1, Color::Black));
+        polygon << Point(0, 0) << Point(10, 30) << Point(40, 5);
+        document << polygon;
+        Path path(Fill(Color::Orange), Stroke(0.5, Color::Black));
+        path << Point(10, 10) << Point(20, 10) << Point(20, 30);
+        path.startNewSubPath();
+        path << Point(100, 100) << Point(110, 120) << Point(105, 130);
+        document << path;
+        document << Text(Point(5, 5), "a < b & \"c\"", Fill(Color::Black), Font(10, "Verdana"));
+    }
+
+    // Retained shapes render like the documents they would have been added
+    //  to, at any layout, and subclasses of built-in shapes keep their type.
+    void retainedTests()
+    {
+        Layout small(Dimensions(100, 100), Layout::TopLeft);
+        Layout large(Dimensions(400, 400), Layout::TopLeft, 4);
+        RetainedDocument retained;
+        Document document("tests_retained.svg", small);
+        Document scaled("tests_retained_large.svg", large);
+        addTypedShapes(document);
+        addTypedShapes(scaled);
+        addTypedShapes(retained);
+        CHECK(retained.toString(small) == document.toString());
+        CHECK(retained.toString(large) == scaled.toString());
+
+        RetainedDocument markers;
+        markers << Marker(Point(10, 10)) << Circle(Point(20, 20), 4, Fill(Color::Red));
+        std::string const svg = markers.toString(small);
+        CHECK(countOf(svg, "<!-- marker -->") == 1);
+        CHECK(countOf(svg, "<circle") == 2);
+        CHECK(markers.size() == 2);
+    }
+
+    // Unchanged shapes are written from their cached fragments; definitions
+    //  of replaced or removed shapes go with them, and removed handles are
+    //  reused.
+    void incrementalTests()
+    {
+        Layout layout(Dimensions(200, 400), Layout::TopLeft);
+        IncrementalDocument document("tests_incremental.svg", layout);
+        IncrementalDocument::Handle circle
+            = document.add(Circle(Point(10, 10), 4, Fill(Color::Red)));
+        IncrementalDocument::Handle chart = document.add(sampleChart(30));
+        document << Rectangle(Point(20, 20), 5, 5, Fill(Color::Blue));
+        std::string svg = document.toString();
+        CHECK(document.cacheHits() == 0);
+        CHECK(document.cacheMisses() == 3);
+        CHECK(countOf(svg, "id=\"dot-1\"") == 1);
+
+        document.resetCacheCounters();
+        CHECK(document.toString() == svg);
+        CHECK(document.cacheHits() == 3);
+        CHECK(document.cacheMisses() == 0);
+
+        document.resetCacheCounters();
+        document.update<Circle>(circle).offset(Point(5, 0));
+        svg = document.toString();
+        CHECK(document.cacheHits() == 2);
+        CHECK(document.cacheMisses() == 1);
+        CHECK(svg.find("cx=\"15\"") != std::string::npos);
+        CHECK(countOf(svg, "id=\"dot-1\"") == 1);
+
+        document.replace(chart, sampleChart(300));
+        svg = document.toString();
+        CHECK(svg.find("id=\"dot-1\"") == std::string::npos);
+        CHECK(countOf(svg, "id=\"dot-10\"") == 1);
+        CHECK(svg.find("r=\"5\"") != std::string::npos);
+
+        document.remove(chart);
+        svg = document.toString();
+        CHECK(svg.find("<defs>") == std::string::npos);
+        CHECK(svg.find("<use") == std::string::npos);
+        bool threw = false;
+        try {
+            document.update<LineChart>(chart);
+        }
+        catch (std::out_of_range const &) {
+            threw = true;
+        }
+        CHECK(threw);
+
+        // The freed handle is reused, and the new shape is drawn last.
+        CHECK(document.add(Line(Point(0, 0), Point(1, 1), Stroke(1, Color::Black))) == chart);
+        svg = document.toString();
+        CHECK(svg.find("<line") > svg.find("<rect"));
+    }
+
+    // Culling drops shapes off the canvas but keeps any whose stroke, miter
+    //  joins included, reaches onto it; GridIndex queries return every item
+    //  whose box meets the area, in order.
+    void cullingTests()
+    {
+        Layout layout(Dimensions(100, 100), Layout::TopLeft);
+        layout.culling = true;
+        Document document("tests_culling.svg", layout);
+        document << Circle(Point(50, 50), 10, Fill(Color::Red));
+        document << Circle(Point(500, 500), 10, Fill(Color::Blue));
+        // A sharp corner at x = -4: the stroke is 4 wide, so half its width
+        //  ends at x = -2, but the miter reaches onto the canvas.
+        Polygon spike(Fill(Color::Transparent), Stroke(4, Color::Green));
+        spike << Point(-30, 49) << Point(-4, 50) << Point(-30, 51);
+        document << spike;
+        std::string const svg = document.toString();
+        CHECK(svg.find("rgb(255,0,0)") != std::string::npos);
+        CHECK(svg.find("rgb(0,0,255)") == std::string::npos);
+        CHECK(svg.find("<polygon") != std::string::npos);
+
+        // Points far beyond one edge collapse to the ends of their run.
+        Polyline wave(Stroke(1, Color::Black));
+        for (int i = 0; i <= 1000; ++i)
+            wave << Point(i - 450.0, 50);
+        std::string out;
+        wave.serialize(out, layout);
+        std::size_t points = out.find("points=\"") + 8;
+        CHECK(countOf(out.substr(points, out.find('"', points) - points), ",") < 150);
+
+        // RetainedDocument uses the index and renders what Document renders.
+        RetainedDocument retained;
+        Document culled("tests_culling_retained.svg", layout);
+        for (int i = 0; i < 400; ++i) {
+            Rectangle cell(Point((i % 20) * 20.0 - 100, (i / 20) * 20.0 - 100), 10, 10,
+                Fill(Color::Black), Stroke(1, Color::Red));
+            retained << cell;
+            culled << cell;
+        }
+        retained.prepare();
+        CHECK(retained.toString(layout) == culled.toString());
+
+        std::vector<Bounds> boxes;
+        for (int i = 0; i < 100; ++i)
+            boxes.push_back(Bounds(Point(i * 10.0, 0), Point(i * 10.0 + 5, 5)));
+        boxes.push_back(Bounds());
+        GridIndex index;
+        index.build(boxes, boxes.size());
+        CHECK(index.size() == boxes.size());
+        std::vector<std::size_t> found;
+        index.query(Bounds(Point(12, 1), Point(31, 2)), found);
+        bool brute_force = true;
+        std::vector<std::size_t> expected;
+        for (std::size_t i = 0; i < boxes.size(); ++i)
+            if (!boxes[i].empty && boxes[i].intersects(Bounds(Point(12, 1), Point(31, 2))))
+                expected.push_back(i);
+        for (std::size_t i = 0; i < expected.size(); ++i)
+            brute_force = brute_force
+                && std::find(found.begin(), found.end(), expected[i]) != found.end();
+        CHECK(brute_force);
+        CHECK(std::is_sorted(found.begin(), found.end()));
+        CHECK(std::adjacent_find(found.begin(), found.end()) == found.end());
+    }
+
+    // Value of the first attribute name="..." in text from position on.
+    double numberAfter(std::string const & text, std::string const & name,
+        std::size_t position = 0)
+    {
+        std::size_t found = text.find(name + "=\"", position);
+        return found == std::string::npos ? -1e300
+            : std::strtod(text.c_str() + found + name.size() + 2, 0);
+    }
+
+    struct StaticLayoutCheck
+    {
+        Layout const * layout;
+        bool * same;
+        template <typename Mapping>
+        void operator()(Mapping const & mapping) const
+        {
+            for (double v = -1000; v <= 1000; v += 0.37)
+                *same = *same && mapping.x(v) == translateX(v, *layout)
+                    && mapping.y(v) == translateY(v, *layout);
+        }
+    };
+
+    // A group draws its children where they would be drawn outside it, for
+    //  every origin, and StaticLayout maps coordinates exactly like Layout.
+    void groupTests()
+    {
+        Layout::Origin const origins[] = { Layout::TopLeft, Layout::BottomLeft,
+            Layout::TopRight, Layout::BottomRight };
+        for (int o = 0; o < 4; ++o) {
+            Layout layout(Dimensions(300, 200), origins[o], 2.5, Point(4, -3),
+                NumberFormat::shortest());
+            Circle circle(Point(17, 29), 6, Fill(Color::Red));
+            Group group;
+            group << circle;
+            std::string const outside = fragment(circle, layout);
+            std::string const inside = fragment(group, layout);
+
+            double matrix[6];
+            char const * p = inside.c_str() + inside.find("matrix(") + 7;
+            for (int i = 0; i < 6; ++i)
+                matrix[i] = std::strtod(p, const_cast<char **>(&p));
+            CHECK(matrix[1] == 0 && matrix[2] == 0);
+            CHECK(matrix[0] == 2.5 && matrix[3] == 2.5);
+            // The children are written with the axes flipped as the origin
+            //  requires, but without scale or offset.
+            double x = numberAfter(inside, "cx");
+            double y = numberAfter(inside, "cy");
+            CHECK(std::fabs(matrix[0] * x + matrix[4] - numberAfter(outside, "cx")) < 1e-9);
+            CHECK(std::fabs(matrix[3] * y + matrix[5] - numberAfter(outside, "cy")) < 1e-9);
+            CHECK(std::fabs(matrix[0] * numberAfter(inside, "r") - numberAfter(outside, "r"))
+                < 1e-9);
+
+            bool same = true;
+            StaticLayoutCheck check = { &layout, &same };
+            withStaticLayout(layout, check);
+            CHECK(same);
+        }
+
+        // Copies are deep, bounds cover all children, and offset() moves them.
+        Group group;
+        group << Circle(Point(0, 0), 2, Fill(Color::Red))
+            << Rectangle(Point(10, 10), 5, 5, Fill(Color::Blue));
+        Group copy = group;
+        group.offset(Point(100, 0));
+        Bounds bounds = copy.getBounds();
+        CHECK(copy.size() == 2 && bounds.min.x == -1 && bounds.max.x == 15);
+        CHECK(group.getBounds().min.x == 99);
+        Group nested;
+        nested << copy << Circle(Point(-50, 0), 2, Fill(Color::Red));
+        CHECK(nested.getBounds().min.x == -51 && nested.getBounds().max.x == 15);
+    }
+
+    // A batch writes what its shapes write through virtual calls, in the
+    //  order they were added, with and without shared styles.
+    void shapeBatchTests()
+    {
+        std::mt19937 random(18);
+        std::uniform_int_distribution<int> type(0, 2);
+        std::uniform_real_distribution<double> coordinate(0, 100);
+        typedef ShapeBatch<Circle, Rectangle, Line> Batch;
+        Batch batch;
+        std::vector<std::unique_ptr<Shape> > shapes;
+        for (int i = 0; i < 1000; ++i) {
+            Point p(coordinate(random), coordinate(random));
+            switch (type(random))
+            {
+                case 0: {
+                    Circle circle(p, 3, Fill(Color::Red));
+                    batch << circle;
+                    shapes.emplace_back(circle.clone());
+                    break;
+                }
+                case 1: {
+                    Rectangle rectangle(p, 4, 2, Fill(Color::Blue), Stroke(1, Color::Black));
+                    batch << rectangle;
+                    shapes.emplace_back(rectangle.clone());
+                    break;
+                }
+                default: {
+                    Line line(p, Point(p.y, p.x), Stroke(0.5, Color::Green));
+                    batch << line;
+                    shapes.emplace_back(line.clone());
+                    break;
+                }
+            }
+        }
+        CHECK(batch.size() == shapes.size());
+
+        Layout layout(Dimensions(100, 100), Layout::BottomLeft, 2);
+        StyleSheet sheet;
+        StyleSheet batch_sheet;
+        for (int shared = 0; shared < 2; ++shared) {
+            Layout virtual_layout = layout;
+            Layout batch_layout = layout;
+            if (shared) {
+                virtual_layout.style_sheet = &sheet;
+                batch_layout.style_sheet = &batch_sheet;
+            }
+            std::string expected;
+            for (std::size_t i = 0; i < shapes.size(); ++i)
+                shapes[i]->serialize(expected, virtual_layout);
+            CHECK(fragment(batch, batch_layout) == expected);
+        }
+
+        Bounds expected_bounds;
+        for (std::size_t i = 0; i < shapes.size(); ++i) {
+            shapes[i]->offset(Point(5, -5));
+            expected_bounds.extend(shapes[i]->getBounds());
+        }
+        std::unique_ptr<Shape> copy(batch.clone());
+        batch.offset(Point(5, -5));
+        Bounds bounds = batch.getBounds();
+        CHECK(bounds.min.x == expected_bounds.min.x && bounds.max.y == expected_bounds.max.y);
+        std::string moved;
+        for (std::size_t i = 0; i < shapes.size(); ++i)
+            shapes[i]->serialize(moved, layout);
+        CHECK(fragment(batch, layout) == moved);
+        CHECK(fragment(*copy, layout) != moved);
+
+        batch.clear();
+        CHECK(batch.size() == 0 && fragment(batch, layout).empty());
+        batch << Line(Point(0, 0), Point(1, 1), Stroke(1, Color::Black));
+        CHECK(fragment(batch, layout) == fragment(Line(Point(0, 0), Point(1, 1),
+            Stroke(1, Color::Black)), layout));
+    }
+
+    // Views write what the owning shapes write, from any coordinate layout,
+    //  without touching the caller's data; the move overloads take the
+    //  buffer instead of copying it.
+    void viewTests()
+    {
+        Layout layout(Dimensions(300, 200), Layout::BottomLeft, 1.5);
+        std::vector<Point> points;
+        std::vector<double> xs;
+        std::vector<double> ys;
+        std::vector<double> interleaved;
+        for (int i = 0; i < 200; ++i) {
+            Point p(i * 1.5, 50 + std::sin(i * 0.1) * 30);
+            points.push_back(p);
+            xs.push_back(p.x);
+            ys.push_back(p.y);
+            interleaved.push_back(p.x);
+            interleaved.push_back(p.y);
+            interleaved.push_back(-1);
+        }
+        Stroke stroke(1, Color::Blue);
+        Polyline polyline(points, Fill(), stroke);
+        std::string const expected = fragment(polyline, layout);
+        CHECK(fragment(PolylineView(CoordinateView(points.data(), points.size()), Fill(),
+            stroke), layout) == expected);
+        CHECK(fragment(PolylineView(CoordinateView(xs.data(), ys.data(), xs.size()), Fill(),
+            stroke), layout) == expected);
+        CHECK(fragment(PolylineView(CoordinateView(interleaved.data(), interleaved.data() + 1,
+            points.size(), 3), Fill(), stroke), layout) == expected);
+
+        Polygon polygon(points, Fill(Color::Yellow), stroke);
+        PolygonView polygon_view(CoordinateView(xs.data(), ys.data(), xs.size()),
+            Fill(Color::Yellow), stroke);
+        CHECK(fragment(polygon_view, layout) == fragment(polygon, layout));
+
+        // Offsets apply when writing; the coordinates stay as they were.
+        PolylineView view(CoordinateView(xs.data(), ys.data(), xs.size()), Fill(), stroke);
+        view.offset(Point(10, -4));
+        polyline.offset(Point(10, -4));
+        CHECK(fragment(view, layout) == fragment(polyline, layout));
+        CHECK(xs[3] == 4.5 && ys[0] == 50);
+        Bounds bounds = view.getBounds();
+        CHECK(bounds.min.x == 10 && bounds.max.x == 199 * 1.5 + 10);
+        std::unique_ptr<Shape> copy(view.clone());
+        CHECK(fragment(*copy, layout) == fragment(view, layout));
+
+        // Decimation works on views as on polylines.
+        Decimation decimation = Decimation::largestTriangle(20);
+        view.setDecimation(decimation);
+        polyline.setDecimation(decimation);
+        CHECK(fragment(view, layout) == fragment(polyline, layout));
+
+        std::vector<Point> buffer = points;
+        Point const * data = buffer.data();
+        Polyline moved(std::move(buffer), Fill(), stroke);
+        CHECK(moved.points.data() == data);
+        std::vector<Point> polygon_buffer = points;
+        data = polygon_buffer.data();
+        Polygon moved_polygon(std::move(polygon_buffer), Fill(), stroke);
+        CHECK(moved_polygon.getPoints().data() == data);
+        LineChart chart;
+        chart << std::move(moved);
+        CHECK(moved.points.empty());
+    }
+
+    // An asynchronous save writes the document as it was when save was
+    //  called, while shapes are still being added; writev() output matches
+    //  the other sinks however the chunks are split.
+    void asyncSaveTests()
+    {
+        Layout layout(Dimensions(400, 300));
+        Document document("tests_async.svg", layout);
+        std::vector<std::unique_ptr<Shape> > shapes;
+        addSampleShapes(shapes);
+        // Several sealed body chunks.
+        while (document.toString().size() < 3 * (1 << 20))
+            for (int i = 0; i < 1000; ++i)
+                document << *shapes[i % shapes.size()];
+        std::string const expected = document.toString();
+        OutputStats stats;
+        std::future<bool> saved = document.saveAsync(&stats);
+        for (int i = 0; i < 1000; ++i)
+            document << Circle(Point(i, i), 2, Fill(Color::Red));
+        CHECK(saved.get());
+        CHECK(readFile("tests_async.svg") == expected);
+        CHECK(stats.raw_bytes == expected.size());
+        CHECK(document.toString() != expected);
+        CHECK(document.save());
+        CHECK(readFile("tests_async.svg") == document.toString());
+
+        std::string collected;
+        StringSink string_sink(collected);
+        CHECK(document.writeTo(string_sink));
+        CHECK(collected == document.toString());
+
+#ifdef SIMPLE_SVG_HAS_WRITEV
+        // More chunks than one writev() call takes, some of them empty.
+        std::vector<std::string> pieces;
+        std::string joined;
+        for (int i = 0; i < 300; ++i) {
+            pieces.push_back(std::string(i % 7 == 0 ? 0 : i * 13, static_cast<char>('a' + i % 26)));
+            joined += pieces.back();
+        }
+        std::vector<OutputChunk> chunks;
+        for (std::size_t i = 0; i < pieces.size(); ++i)
+            chunks.push_back(OutputChunk(pieces[i].data(), pieces[i].size()));
+        {
+            FileDescriptorSink sink("tests_writev.txt");
+            CHECK(sink.good());
+            CHECK(sink.writeChunks(chunks.data(), chunks.size()));
+            CHECK(sink.write("end", 3));
+            CHECK(sink.close());
+        }
+        CHECK(readFile("tests_writev.txt") == joined + "end");
+        FileDescriptorSink missing("no-such-directory/tests_writev.txt");
+        CHECK(!missing.good());
+        CHECK(!missing.write("x", 1));
+#endif
+    }
+
+    // An exception from one task or Build stops the rest and reaches the
+    //  caller, after which the pool and the renderer are still usable.
+    void workerPoolExceptionTests()
+    {
+        WorkerPool pool(4);
+        for (std::size_t throwing = 0; throwing < 2; ++throwing) {
+            bool caught = false;
+            try {
+                pool.run(1000, [&](unsigned, std::size_t i) {
+                    if (i == throwing * 500)
+                        throw std::runtime_error("bad task");
+                });
+            }
+            catch (std::runtime_error const & error) {
+                caught = std::string(error.what()) == "bad task";
+            }
+            CHECK(caught);
+        }
+        std::atomic<int> calls(0);
+        pool.run(100, [&](unsigned, std::size_t) { ++calls; });
+        CHECK(calls == 100);
+
+        BatchRenderer batch(Layout(Dimensions(50, 50)), 4);
+        for (int i = 0; i < 64; ++i)
+            batch.add("tests_batch_" + std::to_string(i) + ".svg", [i](BatchDocument & doc) {
+                if (i == 17)
+                    throw std::runtime_error("bad data");
+                doc << Circle(Point(i % 50, 25), 4, Fill(Color::Red));
+            });
+        bool caught = false;
+        try {
+            batch.renderFiles();
+        }
+        catch (std::runtime_error const & error) {
+            caught = std::string(error.what()) == "bad data";
+        }
+        CHECK(caught);
+        batch.clear();
+        batch.add("tests_batch_0.svg", [](BatchDocument & doc) {
+            doc << Circle(Point(10, 10), 4, Fill(Color::Red));
+        });
+        CHECK(batch.renderFiles());
+    }
+
+    // Entries are ustar headers followed by the document padded to 512
+    //  bytes, the archive ends in two zero blocks, and rendering the same
+    //  jobs again gives the same bytes.
+    void batchArchiveTests()
+    {
+        std::string const long_name = std::string(120, 'd') + "/chart.svg";
+        BatchRenderer batch(Layout(Dimensions(50, 50)), 1);
+        batch.setStyleSharing(true);
+        batch.add("first.svg", [](BatchDocument & doc) {
+            doc << Circle(Point(10, 10), 4, Fill(Color::Red));
+        });
+        batch.add(long_name, [](BatchDocument & doc) {
+            doc << Rectangle(Point(1, 2), 3, 4, Fill(Color::Blue));
+        });
+        CHECK(batch.renderArchive("tests_batch.tar"));
+        std::string const archive = readFile("tests_batch.tar");
+        CHECK(batch.renderArchive("tests_batch.tar"));
+        CHECK(readFile("tests_batch.tar") == archive);
+        CHECK(archive.size() % 512 == 0);
+
+        std::vector<std::string> names;
+        std::size_t at = 0;
+        while (at + 512 <= archive.size() && archive[at] != '\0') {
+            char const * header = archive.data() + at;
+            CHECK(std::string(header + 257, 5) == "ustar");
+            unsigned long long checksum = 0;
+            for (std::size_t i = 0; i < 512; ++i)
+                checksum += i >= 148 && i < 156 ? ' ' : static_cast<unsigned char>(header[i]);
+            CHECK(std::strtoull(header + 148, 0, 8) == checksum);
+            CHECK(std::strtoull(header + 136, 0, 8) == 0);
+            std::string name(header + 345, std::find(header + 345, header + 500, '\0'));
+            name += name.empty() ? "" : "/";
+            name.append(header, std::find(header, header + 100, '\0'));
+            names.push_back(name);
+            std::size_t size = static_cast<std::size_t>(std::strtoull(header + 124, 0, 8));
+            std::string content = archive.substr(at + 512, size);
+            CHECK(content.compare(0, 5, "<?xml") == 0);
+            CHECK(content.find("</svg>") == size - 7);
+            CHECK(content.find(".s0{") != std::string::npos);
+            at += 512 + (size + 511) / 512 * 512;
+        }
+        CHECK(names.size() == 2 && names[0] == "first.svg" && names[1] == long_name);
+        CHECK(at + 1024 == archive.size());
+        CHECK(archive.find_first_not_of('\0', at) == std::string::npos);
+    }
+
+    void escapingTests()
+    {
+        std::string out;
+        char const text[] = "<a & \"b\">";
+        appendEscaped(out, text, sizeof text - 1, true);
+        CHECK(out == "&lt;a &amp; &quot;b&quot;>");
+        out.clear();
+        appendEscaped(out, text, sizeof text - 1, false);
+        CHECK(out == "&lt;a &amp; \"b\">");
+        std::string back;
+        appendUnescaped(back, out.data(), out.size());
+        CHECK(back == text);
+
+        Layout layout(Dimensions(100, 100));
+        Document document("tests_escaping.svg", layout);
+        document << Text(Point(1, 2), "x</text><svg>", Fill(), Font(10, "A\"B"));
+        std::string const svg = document.toString();
+        CHECK(svg.find("x&lt;/text>&lt;svg>") != std::string::npos);
+        CHECK(svg.find("font-family=\"A&quot;B\"") != std::string::npos);
+
+        // Style values with CSS delimiters are quoted instead of ending the
+        //  rule; only ordinary values are written as they are.
+        StyleSheet sheet;
+        layout.style_sheet = &sheet;
+        out.clear();
+        Text(Point(1, 2), "t", Fill(Color::Black), Font(12, "a;b}c")).serialize(out, layout);
+        Text(Point(1, 2), "t", Fill(Color::Black), Font(12, "Verdana")).serialize(out, layout);
+        std::string css;
+        sheet.serialize(css);
+        CHECK(css.find("font-family:\"a;b}c\"") != std::string::npos);
+        CHECK(css.find("font-family:Verdana") != std::string::npos);
+    }
+
+    std::string unescaped(std::string const & text)
+    {
+        std::string out;
+        appendUnescaped(out, text.data(), text.size());
+        return out;
+    }
+
+    // Character references decode to UTF-8; those no UTF-8 text may hold
+    //  become U+FFFD and malformed ones are kept as they are.
+    void characterReferenceTests()
+    {
+        std::string const replacement = "\xef\xbf\xbd";
+        CHECK(unescaped("&#65;&#x42;") == "AB");
+        CHECK(unescaped("&#xe9;") == "\xc3\xa9");
+        CHECK(unescaped("&#x20ac;") == "\xe2\x82\xac");
+        CHECK(unescaped("&#x1F600;") == "\xf0\x9f\x98\x80");
+        CHECK(unescaped("&#x10FFFF;") == "\xf4\x8f\xbf\xbf");
+        CHECK(unescaped("a&#0;b") == "a" + replacement + "b");
+        CHECK(unescaped("&#x110000;") == replacement);
+        CHECK(unescaped("&#99999999999999999999;") == replacement);
+        CHECK(unescaped("&#xD800;&#xDFFF;") == replacement + replacement);
+        CHECK(unescaped("&#xd7ff;") == "\xed\x9f\xbf");
+        CHECK(unescaped("&#;&#x;&#12a;&#-5;") == "&#;&#x;&#12a;&#-5;");
+
+        // CSS escapes are decoded the same way.
+        std::string css;
+        char const value[] = "\"a\\0 b\\110000 c\"";
+        appendCssValue(css, value, value + sizeof value - 1);
+        CHECK(css == "a" + replacement + "b" + replacement + "c");
+    }
+
+    void numberTests()
+    {
+        std::mt19937_64 random(1);
+        std::uniform_real_distribution<double> coordinate(-1e4, 1e4);
+        int mismatches = 0;
+        for (int i = 0; i < 100000; ++i) {
+            double value = coordinate(random);
+            if (i % 2) {
+                unsigned long long bits = random();
+                std::memcpy(&value, &bits, sizeof value);
+                if (!std::isfinite(value))
+                    continue;
+            }
+            std::string text;
+            appendShortest(text, value);
+            mismatches += !readsBack(text, value);
+        }
+        CHECK(mismatches == 0);
+        CHECK(readsBack("13.387664401253275", 13.387664401253275));
+        CHECK(readsBack("9007199254740993", 9007199254740992.0));
+        CHECK(readsBack("1e23", 1e23));
+        CHECK(readsBack("4.9e-324", 4.9e-324));
+        CHECK(readsBack("-.5", -0.5));
+
+        // Numbers run together, as CompactEncoder writes them.
+        std::string const packed = "1.5.5-2e1,3";
+        char const * p = packed.data();
+        double a, b, c, d;
+        CHECK(readNumber(p, p + packed.size(), a) && readNumber(p, p + packed.size(), b)
+            && readNumber(p, p + packed.size(), c) && readNumber(p, p + packed.size(), d));
+        CHECK(a == 1.5 && b == 0.5 && c == -20 && d == 3);
+        CHECK(!readNumber(p, p + packed.size(), a));
+    }
+
+    // Every shape the reader knows comes back as it was written, with each
+    //  origin, the compact encoding and shared styles.
+    void roundTripTests()
+    {
+        std::vector<std::unique_ptr<Shape> > shapes;
+        addSampleShapes(shapes);
+        Layout::Origin const origins[] = { Layout::BottomLeft, Layout::TopLeft,
+            Layout::TopRight, Layout::BottomRight };
+        for (int origin = 0; origin < 4; ++origin)
+            for (int variant = 0; variant < 4; ++variant) {
+                Layout layout(Dimensions(400, 300), origins[origin], 1 + variant % 2,
+                    Point(3, 4));
+                if (variant >= 2)
+                    layout.point_encoding = PointEncoding::compact(0.01);
+                Document document("tests_round_trip.svg", layout);
+                document.setStyleSharing(variant % 2 == 1);
+                for (std::size_t i = 0; i < shapes.size(); ++i)
+                    document << *shapes[i];
+                CHECK(document.save());
+
+                std::vector<std::unique_ptr<Shape> > read =
+                    readShapes("tests_round_trip.svg", layout);
+                CHECK(read.size() == shapes.size());
+                for (std::size_t i = 0; i < read.size() && i < shapes.size(); ++i)
+                    CHECK(fragment(*read[i], layout) == fragment(*shapes[i], layout));
+            }
+    }
+
+    // Appending twice leaves one document whose style classes are all
+    //  distinct and all found by the reader.
+    void appendTests()
+    {
+        Layout layout(Dimensions(200, 200));
+        Color const colors[] = { Color::Red, Color::Green, Color::Blue };
+        std::remove("tests_append.svg");
+        for (int i = 0; i < 3; ++i) {
+            Document document("tests_append.svg", layout);
+            if (i > 0)
+                CHECK(document.setAppend(true));
+            document.setStyleSharing(true);
+            document << Circle(Point(10 + i * 20, 10), 5, Fill(colors[i]));
+            document << Circle(Point(10 + i * 20, 50), 5, Fill(colors[i]),
+                Stroke(i + 1, Color::Black));
+            CHECK(document.save());
+        }
+
+        SvgFileReader file("tests_append.svg");
+        CHECK(file.good());
+        CHECK(file.styleClassCount() == 6);
+        std::vector<std::unique_ptr<Shape> > read = readShapes("tests_append.svg", layout);
+        CHECK(read.size() == 6);
+        for (std::size_t i = 0; i < read.size(); ++i) {
+            int round = static_cast<int>(i / 2);
+            Circle expected(Point(10 + round * 20, i % 2 ? 50 : 10), 5, Fill(colors[round]),
+                i % 2 ? Stroke(round + 1, Color::Black) : Stroke());
+            CHECK(fragment(*read[i], layout) == fragment(expected, layout));
+        }
+
+        std::string text(file.data(), file.fileSize());
+        CHECK(text.find("</svg>") == file.closingTag());
+        CHECK(text.find("<svg") == text.rfind("<svg"));
+
+        Document missing("tests_missing.svg", layout);
+        std::remove("tests_missing.svg");
+        CHECK(!missing.setAppend(true));
+    }
+
+    // Saving an appending document again rewrites its additions instead of
+    //  adding them twice, and shapes added in between are included.
+    void appendSaveTests()
+    {
+        Layout layout(Dimensions(100, 100));
+        Document base("tests_append_save.svg", layout);
+        base << Circle(Point(10, 10), 4, Fill(Color::Red));
+        CHECK(base.save());
+
+        Document document("tests_append_save.svg", layout);
+        CHECK(document.setAppend(true));
+        document.setStyleSharing(true);
+        document << Circle(Point(20, 20), 4, Fill(Color::Blue));
+        CHECK(!document.setAppend(false));
+        CHECK(document.save());
+        std::string const once = readFile("tests_append_save.svg");
+        CHECK(document.save());
+        CHECK(document.saveAsync().get());
+        CHECK(readFile("tests_append_save.svg") == once);
+        CHECK(countOf(once, "<circle") == 2);
+        CHECK(countOf(once, "<style") == 1);
+
+        document << Circle(Point(30, 30), 4, Fill(Color::Green));
+        CHECK(document.save());
+        std::string const twice = readFile("tests_append_save.svg");
+        CHECK(countOf(twice, "<circle") == 3);
+        CHECK(countOf(twice, "<style") == 1);
+        CHECK(countOf(twice, "</svg>") == 1);
+        CHECK(readShapes("tests_append_save.svg", layout).size() == 3);
+    }
+
+    // Class numbers continue from the last <style> element even when the
+    //  append before wrote none, and shapes keep the styles of their own
+    //  append.
+    void appendStyleTests()
+    {
+        Layout layout(Dimensions(100, 100));
+        Color const colors[] = { Color::Red, Color::Green, Color::Blue };
+        std::remove("tests_append_style.svg");
+        for (int i = 0; i < 3; ++i) {
+            Document document("tests_append_style.svg", layout);
+            if (i > 0)
+                CHECK(document.setAppend(true));
+            document.setStyleSharing(i != 1);
+            document << Circle(Point(10 + i * 20, 10), 4, Fill(colors[i]));
+            CHECK(document.save());
+        }
+        SvgFileReader file("tests_append_style.svg");
+        CHECK(file.styleClassCount() == 2);
+        SvgFileReader::Section style;
+        CHECK(file.style(style));
+        std::string const text(file.data(), file.fileSize());
+        CHECK(style.begin == text.rfind("<style"));
+        CHECK(text.find(".s1{") > style.begin && text.find(".s1{") < style.end);
+
+        std::vector<std::unique_ptr<Shape> > read = readShapes("tests_append_style.svg", layout);
+        CHECK(read.size() == 3);
+        for (std::size_t i = 0; i < read.size(); ++i)
+            CHECK(fragment(*read[i], layout)
+                == fragment(Circle(Point(10 + i * 20.0, 10), 4, Fill(colors[i])), layout));
+    }
+
+    void rollingWindowTests()
+    {
+        RollingSeries series(4);
+        CHECK(series.size() == 0 && series.getBounds().empty);
+        for (int i = 0; i < 10; ++i)
+            series.push(Point(i, i == 5 ? 100 : i));
+        CHECK(series.size() == 4 && series.capacity() == 4);
+        CoordinateView window = series.window();
+        CHECK(window.count == 4);
+        for (std::size_t i = 0; i < window.count; ++i)
+            CHECK(window.x(i) == 6 + static_cast<double>(i));
+
+        // The spike at 5 has left the window, and with it the maximum.
+        Bounds bounds = series.getBounds();
+        CHECK(bounds.min.x == 6 && bounds.max.x == 9 && bounds.min.y == 6 && bounds.max.y == 9);
+        series.clear();
+        CHECK(series.size() == 0 && series.getBounds().empty);
+
+        RollingLineChart chart(3);
+        std::size_t index = chart.addSeries();
+        for (int i = 0; i < 5; ++i)
+            chart.push(index, Point(i, i * i));
+        Bounds range = chart.getRange();
+        CHECK(range.min.x == 2 && range.max.x == 4 && range.min.y == 4 && range.max.y == 16);
+        std::string out;
+        chart.serialize(out, Layout(Dimensions(100, 100), Layout::TopLeft));
+        CHECK(out.find("points=\"0,0 1,5 2,12 \"") != std::string::npos);
+    }
+
+    // A tile pyramid holds every shape once at the deepest level, in the
+    //  tile it lies in, leaves small shapes out of coarser levels, places
+    //  <use> where its definition lands, and skips empty tiles.
+    void tileTests()
+    {
+#ifdef _WIN32
+        std::system("if not exist tests_tiles mkdir tests_tiles");
+#else
+        std::system("mkdir -p tests_tiles");
+#endif
+        Layout layout(Dimensions(1024, 512), Layout::TopLeft);
+        TileExporter exporter(layout, 256, 3);
+        CHECK(exporter.levelCount() == 3);
+        // Dots in the middle of the tiles of the top row only.
+        for (int column = 0; column < 4; ++column)
+            exporter << Circle(Point(column * 256 + 128, 100), 4, Fill(Color::Red));
+        exporter << Rectangle(Point(10, 400), 500, 100, Fill(Color::Blue));
+        exporter.define("mark", Rectangle(Point(0, 0), 6, 6, Fill(Color::Green)));
+        exporter << Use("mark", Point(900, 450));
+        exporter.setLevelOfDetail(LevelOfDetail(8));
+        OutputStats stats;
+        CHECK(exporter.save("tests_tiles", &stats));
+
+        int circles = 0;
+        for (int column = 0; column < 4; ++column) {
+            std::string const tile = readFile("tests_tiles/2_" + std::to_string(column) + "_0.svg");
+            CHECK(countOf(tile, "<circle") == 1);
+            circles += countOf(tile, "<circle");
+        }
+        CHECK(circles == 4);
+        // The rectangle spans the first two columns of the bottom row.
+        CHECK(countOf(readFile("tests_tiles/2_0_1.svg"), "rgb(0,0,255)") == 1);
+        CHECK(countOf(readFile("tests_tiles/2_1_1.svg"), "rgb(0,0,255)") == 1);
+        CHECK(countOf(readFile("tests_tiles/2_0_0.svg"), "rgb(0,0,255)") == 0);
+        CHECK(readFile("tests_tiles/2_2_1.svg").empty());
+        std::string const corner = readFile("tests_tiles/2_3_1.svg");
+        CHECK(countOf(corner, "xlink:href=\"#mark\"") == 1);
+        CHECK(countOf(corner, "id=\"mark\"") == 1);
+
+        // At level 0 the dots are 2 pixels wide and left out.
+        std::string const top = readFile("tests_tiles/0_0_0.svg");
+        CHECK(countOf(top, "<circle") == 0);
+        CHECK(countOf(top, "rgb(0,0,255)") == 1);
+        CHECK(top.find("width=\"256px\" height=\"128px\"") != std::string::npos);
+
+        std::string const index = readFile("tests_tiles/index.json");
+        CHECK(index.find("\"tile_size\": 256") != std::string::npos);
+        CHECK(index.find("\"file\": \"2_3_1.svg\"") != std::string::npos);
+        CHECK(index.find("2_2_1.svg") == std::string::npos);
+        CHECK(stats.raw_bytes > 0 && stats.raw_bytes == stats.compressed_bytes);
+    }
+}
+
+int main()
+{
+    serializeableTests();
+    numberFormatTests();
+    streamingTests();
+    compressionTests();
+    parallelTests();
+    polylineBoundsTests();
+    decimationTests();
+    instancingTests();
+    statsTests();
+    retainedTests();
+    incrementalTests();
+    cullingTests();
+    groupTests();
+    shapeBatchTests();
+    viewTests();
+    asyncSaveTests();
+    workerPoolExceptionTests();
+    batchArchiveTests();
+    escapingTests();
+    characterReferenceTests();
+    numberTests();
+    roundTripTests();
+    appendTests();
+    appendSaveTests();
+    appendStyleTests();
+    rollingWindowTests();
+    tileTests();
+    if (failures) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All tests passed\n";
+    return 0;
+}